@@ -9,21 +9,26 @@ Expression::Expression() = default;
 Expression::~Expression() = default;
 string Expression::serialize() const {return "";}
 string Expression::getType() const {return type;}
+Token Expression::getToken() const {return Token{};}
 
 string Identifier::serialize() const {return value;}
 string Identifier::getType() const {return type;}
+Token Identifier::getToken() const {return token;};
 
 IntLiteral::IntLiteral(Token tok, int val) : token(tok), value(val) {};
 string IntLiteral::serialize() const {return token.literal;};
 string IntLiteral::getType() const {return type;};
+Token IntLiteral::getToken() const {return token;};
 
 BoolLiteral::BoolLiteral(Token tok, bool val) : token(tok), value(val){};
 string BoolLiteral::serialize() const {return token.literal;}
 string BoolLiteral::getType() const {return type;};
+Token BoolLiteral::getToken() const {return token;};
 
 StringLiteral::StringLiteral(Token tok, string val) : token(tok), value(val) {};
 string StringLiteral::serialize() const {return "\"" + value + "\"";};
 string StringLiteral::getType() const {return type;};
+Token StringLiteral::getToken() const {return token;};
 
 FnLiteral::FnLiteral(Token tok, vector<unique_ptr<Expression>>&& params, unique_ptr<BlockStatement>& body) : token(tok), params(move(params)), body(move(body)) {};
 string FnLiteral::serialize() const {
@@ -40,6 +45,7 @@ string FnLiteral::serialize() const {
     return "fn" + paramStr + body.get()->serialize();
 }
 string FnLiteral::getType() const {return type;};
+Token FnLiteral::getToken() const {return token;};
 
 ArrayLiteral::ArrayLiteral(Token tok, vector<unique_ptr<Expression>>&& elements) : token(tok), elements(move(elements)) {};
 string ArrayLiteral::serialize() const {
@@ -52,6 +58,7 @@ string ArrayLiteral::serialize() const {
     return res;
 }
 string ArrayLiteral::getType() const {return type;};
+Token ArrayLiteral::getToken() const {return token;};
 
 HashLiteral::HashLiteral(Token tok, vector<pair<unique_ptr<Expression>, unique_ptr<Expression>>>& pairs) : token(tok), pairs(move(pairs)) {};
 string HashLiteral::serialize() const {
@@ -67,6 +74,7 @@ string HashLiteral::serialize() const {
     return res;
 }
 string HashLiteral::getType() const {return type;};
+Token HashLiteral::getToken() const {return token;};
 
 IndexExpression::IndexExpression(Token tok, unique_ptr<Expression>& entity, unique_ptr<Expression>& index) : token(tok), entity(move(entity)), index(move(index)) {};
 string IndexExpression::serialize() const {
@@ -79,6 +87,7 @@ string IndexExpression::serialize() const {
 string IndexExpression::getType() const {
     return type;
 }
+Token IndexExpression::getToken() const {return token;};
 
 PrefixExpression::PrefixExpression() = default;
 PrefixExpression::PrefixExpression(Token tok, string Operator, unique_ptr<Expression>& right) : token(tok), Operator(Operator), right(move(right)) {};
@@ -88,6 +97,7 @@ string PrefixExpression::serialize() const {
 string PrefixExpression::getType() const {
     return type;
 }
+Token PrefixExpression::getToken() const {return token;};
 
 InfixExpression::InfixExpression() = default;
 InfixExpression::InfixExpression(Token tok, string Operator, unique_ptr<Expression>& left, unique_ptr<Expression>& right) : token(tok), Operator(Operator), left(move(left)), right(move(right)) {};
@@ -98,6 +108,7 @@ string InfixExpression::serialize() const {
 string InfixExpression::getType() const {
     return type;
 }
+Token InfixExpression::getToken() const {return token;};
 
 IfExpression::IfExpression(Token tok, 
 unique_ptr<Expression>& cond, 
@@ -111,6 +122,7 @@ string IfExpression::serialize() const {
             consequence.get()->serialize() + alt;
 }
 string IfExpression::getType() const {return type;};
+Token IfExpression::getToken() const {return token;};
 
 CallExpression::CallExpression(Token tok, unique_ptr<Expression>& function, vector<unique_ptr<Expression>>&& args) : token(tok), function(move(function)), args(move(args)) {};
 string CallExpression::serialize() const {
@@ -123,12 +135,14 @@ string CallExpression::serialize() const {
     return function.get()->serialize() + paramStr;
 }
 string CallExpression::getType() const {return type;};
+Token CallExpression::getToken() const {return token;};
 
 /************************* Statements ************************/
 Statement::Statement() = default;
 Statement::~Statement() = default;
 string Statement::serialize() const {return "";};
 string Statement::getType() const {return type;};
+Token Statement::getToken() const {return Token{};};
 
 LetStatement::LetStatement() = default;
 LetStatement::LetStatement(Token tok, Identifier ident, unique_ptr<Expression>& val) : token(tok), identifier(ident), value(move(val)) {};
@@ -141,6 +155,7 @@ string LetStatement::serialize() const {
     
 };
 string LetStatement::getType() const {return type;};
+Token LetStatement::getToken() const {return token;};
 
 ReturnStatement::ReturnStatement() = default;
 ReturnStatement::ReturnStatement(Token tok, unique_ptr<Expression>& val) : token(tok), value(move(val)) {}
@@ -148,6 +163,7 @@ string ReturnStatement::serialize() const {
     return token.literal + " " + value.get()->serialize() + ";";
 }
 string ReturnStatement::getType() const {return type;};
+Token ReturnStatement::getToken() const {return token;};
 
 /* To allow for a single line expression like "x + 5;"*/
 ExpressionStatement::ExpressionStatement() {
@@ -158,6 +174,7 @@ string ExpressionStatement::serialize() const {
     return expression.get()->serialize();
 }
 string ExpressionStatement::getType() const {return type;};
+Token ExpressionStatement::getToken() const {return token;};
 
 BlockStatement::BlockStatement(Token tok, vector<unique_ptr<Statement>>&& stmts) : token(tok), statements(move(stmts)) {};
 string BlockStatement::serialize() {
@@ -168,6 +185,14 @@ string BlockStatement::serialize() {
     return res + "}";
 }
 string BlockStatement::getType() const {return type;};
+Token BlockStatement::getToken() const {return token;};
+
+WhileStatement::WhileStatement(Token tok, unique_ptr<Expression>& cond, unique_ptr<BlockStatement>& body) : token(tok), condition(move(cond)), body(move(body)) {};
+string WhileStatement::serialize() const {
+    return "while " + condition.get()->serialize() + " " + body.get()->serialize();
+}
+string WhileStatement::getType() const {return type;};
+Token WhileStatement::getToken() const {return token;};
 
 /*********************** Program (root node) ********************/ 
 string Program::serialize() const {
@@ -179,3 +204,4 @@ string Program::serialize() const {
     return res;
 }
 string Program::getType() const {return type;};
+Token Program::getToken() const {return Token{};};
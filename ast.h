@@ -11,6 +11,7 @@ class Node {
     string type;
     virtual string serialize() const = 0;
     virtual string getType() const = 0;
+    virtual Token getToken() const = 0;
 };
 
 // turn all fields into pointers
@@ -23,6 +24,7 @@ struct NodeType {
     const string Statement = "STATEMENT";
     const string LetStatement = "LET_STATEMENT";
     const string ReturnStatement = "RETURN_STATEMENT";
+    const string WhileStatement = "WHILE_STATEMENT";
     const string BlockStatement = "BLOCK_STATEMENT";
     const string IntLiteral = "INT_LITERAL";
     const string BoolLiteral = "BOOL_LITERAL";
@@ -48,6 +50,7 @@ class Expression : public Node {
     virtual ~Expression();
     virtual string serialize() const;
     virtual string getType() const;
+    virtual Token getToken() const;
 };
 class Identifier : public Expression {
     public:
@@ -56,6 +59,7 @@ class Identifier : public Expression {
     string value;
     string serialize() const final override;
     string getType() const final override;
+    Token getToken() const final override;
 };
 /************************* Statements ************************/
 class Statement : public Node {
@@ -65,6 +69,7 @@ class Statement : public Node {
     virtual ~Statement();
     virtual string serialize() const;
     virtual string getType() const;
+    virtual Token getToken() const;
 };
 class LetStatement: public Statement {
     public:
@@ -77,6 +82,7 @@ class LetStatement: public Statement {
     
     string serialize() const final override;
     string getType() const final override;
+    Token getToken() const final override;
 };
 class ReturnStatement: public Statement {
     public:
@@ -87,6 +93,7 @@ class ReturnStatement: public Statement {
     ReturnStatement(Token tok, unique_ptr<Expression>& val);
     string serialize() const final override;
     string getType() const final override;
+    Token getToken() const final override;
 };
 
 /* To allow for a single line expression like "x + 5;"*/
@@ -100,6 +107,7 @@ class ExpressionStatement: public Statement {
 
     string serialize() const final override;
     string getType() const final override;
+    Token getToken() const final override;
 };
 class BlockStatement : public Statement {
     public:
@@ -109,6 +117,18 @@ class BlockStatement : public Statement {
     BlockStatement(Token tok, vector<unique_ptr<Statement>>&& stmts);
     string serialize();
     string getType() const final override;
+    Token getToken() const final override;
+};
+class WhileStatement : public Statement {
+    public:
+    Token token;
+    string type = ntypes.WhileStatement;
+    unique_ptr<Expression> condition;
+    unique_ptr<BlockStatement> body;
+    WhileStatement(Token tok, unique_ptr<Expression>& cond, unique_ptr<BlockStatement>& body);
+    string serialize() const final override;
+    string getType() const final override;
+    Token getToken() const final override;
 };
 // Expressions
 class IntLiteral : public Expression {
@@ -119,6 +139,7 @@ class IntLiteral : public Expression {
     IntLiteral(Token tok, int val);
     string serialize() const final override;
     string getType() const final override;
+    Token getToken() const final override;
 };
 class BoolLiteral : public Expression {
     public:
@@ -128,6 +149,7 @@ class BoolLiteral : public Expression {
     BoolLiteral(Token tok, bool val);
     string serialize() const final override;
     string getType() const final override;
+    Token getToken() const final override;
 };
 class StringLiteral : public Expression {
     public:
@@ -138,6 +160,7 @@ class StringLiteral : public Expression {
     StringLiteral(Token tok, string val);
     string serialize() const final override;
     string getType() const final override;
+    Token getToken() const final override;
 };
 class FnLiteral : public Expression {
     public:
@@ -148,6 +171,7 @@ class FnLiteral : public Expression {
     FnLiteral(Token tok, vector<unique_ptr<Expression>>&& params, unique_ptr<BlockStatement>& body);
     string serialize() const override;
     string getType() const override;
+    Token getToken() const override;
 };
 class ArrayLiteral : public Expression {
     public:
@@ -157,6 +181,7 @@ class ArrayLiteral : public Expression {
     ArrayLiteral(Token tok, vector<unique_ptr<Expression>>&& elements);
     string serialize() const override;
     string getType() const override;
+    Token getToken() const override;
 };
 // struct HashPair {
 //     Expression* key;
@@ -170,6 +195,7 @@ class HashLiteral : public Expression {
     HashLiteral(Token tok, vector<pair<unique_ptr<Expression>, unique_ptr<Expression>>>& pairs);
     string serialize() const override;
     string getType() const override;
+    Token getToken() const override;
 };
 class PrefixExpression : public Expression {
     public:
@@ -181,6 +207,7 @@ class PrefixExpression : public Expression {
     PrefixExpression(Token tok, string Operator, unique_ptr<Expression>& right);
     string serialize() const override;
     string getType() const override;
+    Token getToken() const override;
 };
 class IndexExpression : public Expression {
     public:
@@ -192,6 +219,7 @@ class IndexExpression : public Expression {
     IndexExpression(Token tok, unique_ptr<Expression>& entity, unique_ptr<Expression>& index);
     string serialize() const override;
     string getType() const override;
+    Token getToken() const override;
 };
 class InfixExpression : public Expression {
     public:
@@ -204,6 +232,7 @@ class InfixExpression : public Expression {
     InfixExpression(Token tok, string Operator, unique_ptr<Expression>& left, unique_ptr<Expression>& right);
     string serialize() const override;
     string getType() const override;
+    Token getToken() const override;
 };
 class IfExpression : public Expression {
     public:
@@ -220,6 +249,7 @@ class IfExpression : public Expression {
     
     string serialize() const override;
     string getType() const override;
+    Token getToken() const override;
 };
 class CallExpression : public Expression {
     public:
@@ -231,6 +261,7 @@ class CallExpression : public Expression {
     CallExpression(Token tok, unique_ptr<Expression>& function, vector<unique_ptr<Expression>>&& args);
     string serialize() const override;
     string getType() const override;
+    Token getToken() const override;
 };
 
 /*********************** Program (root node) ********************/ 
@@ -242,4 +273,5 @@ class Program : public Node {
     // Program(vector<unique_ptr<Statement>>& statements) : statements(statements) {};
     string serialize() const final override;
     string getType() const override;
+    Token getToken() const override;
 };
\ No newline at end of file
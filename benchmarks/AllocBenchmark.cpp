@@ -0,0 +1,105 @@
+#include"../vm.cpp"
+#include<chrono>
+#include<iostream>
+#include<malloc.h>
+
+using namespace std;
+
+/* Allocation-heavy programs run with objects from operator new and from the
+heap's slab allocator: wall time, time spent collecting (which includes freeing),
+and how much of the memory held for objects is not in use. For operator new that
+is the free share of the malloc arena, for slabs the free share of the slabs.
+Build with optimizations, e.g. cmake -DCMAKE_BUILD_TYPE=Release. */
+
+const int repetitions = 5;
+const int churn = 1000000;
+
+vector<pair<string, string>> programs = {
+    {"strings", "let i = 0; let s = \"\"; while (i < 100000) { let s = \"a\" + \"b\" + \"c\"; let i = i + 1; }; s;"},
+    {"arrays", "let i = 0; let a = []; while (i < 100000) { let a = [[i], [i, i], [i, [i]]]; let i = i + 1; }; a[2];"},
+    {"hashes", "let i = 0; let h = {}; while (i < 100000) { let h = {i: [i], \"k\": {1: i}}; let i = i + 1; }; h[\"k\"];"},
+    {"calls", "let f = fn() { [1] }; let g = fn() { [f(), f()] }; let i = 0; let s = []; while (i < 50000) { let s = g(); let i = i + 1; }; s;"},
+};
+
+struct Result {
+    double ms = 0;
+    double collectMs = 0;
+    double arenaFree = 0; // share of the malloc arena not in use
+    double slabFree = 0; // share of the slabs not in use
+    string value;
+};
+
+int run(string input, bool useSlabs, Result* result) {
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    if (p.parseProgram(&program)) return 1;
+    auto compiler = Compiler();
+    if (compiler.compileProgram(&program)) return 1;
+    auto bytecode = compiler.getByteCode();
+    *result = Result();
+    for (int r = 0; r < repetitions; r++) {
+        ByteCode copy = {bytecode.instructions, vector<unique_ptr<Object>>()};
+        for (auto& obj : bytecode.constants) copy.constants.push_back(compiler.copyConstant(obj.get()));
+        auto vm = VM(move(copy));
+        vm.heap.useSlabs = useSlabs;
+        vm.heap.minThreshold = vm.heap.threshold = 256 << 10;
+        auto start = chrono::steady_clock::now();
+        if (vm.run()) return 1;
+        result->ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / repetitions;
+        result->collectMs += vm.heap.stats.totalPauseMs / repetitions;
+        struct mallinfo2 info = mallinfo2();
+        result->arenaFree = info.arena == 0 ? 0 : (double) info.fordblks / info.arena;
+        result->slabFree = vm.heap.slabs.fragmentation();
+        result->value = vm.getLastPopped().serialize();
+    }
+    return 0;
+}
+
+/* Allocator time alone: arrays made and freed in a sliding window */
+double allocatorMs(bool useSlabs) {
+    SlabAllocator slabs;
+    vector<Array*> window(1024, nullptr);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < churn; i++) {
+        Array*& slot = window[i % window.size()];
+        if (slot != nullptr && useSlabs) {
+            slot->~Array();
+            slabs.deallocate(slot, sizeof(Array));
+        } else if (slot != nullptr) {
+            delete slot;
+        }
+        if (useSlabs) slot = new (slabs.allocate(sizeof(Array))) Array(vector<Value>());
+        else slot = new Array(vector<Value>());
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    for (auto obj : window) {
+        if (useSlabs) obj->~Array();
+        else delete obj;
+    }
+    return ms;
+}
+
+int main() {
+    cout << "object sizes in bytes, " << objectSizeReport() << endl;
+    cout << "allocate and free " << churn << " objects: " << allocatorMs(false) << " -> " << allocatorMs(true) << " ms" << endl;
+    for (auto& program : programs) {
+        Result results[2];
+        for (int slabs = 0; slabs <= 1; slabs++) {
+            if (run(program.second, slabs, &results[slabs])) {
+                cout << program.first << " failed" << endl;
+                return 1;
+            }
+        }
+        if (results[0].value != results[1].value) {
+            cout << program.first << ": results differ, " << results[0].value << " vs " << results[1].value << endl;
+            return 1;
+        }
+        cout << program.first << ": operator new -> slabs" << endl
+            << "  wall time: " << results[0].ms << " -> " << results[1].ms << " ms"
+            << ", collecting: " << results[0].collectMs << " -> " << results[1].collectMs << " ms" << endl
+            << "  unused: " << (int) (results[0].arenaFree * 100) << "% of the malloc arena -> "
+            << (int) (results[1].slabFree * 100) << "% of the slabs" << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include"../vm.cpp"
+#include<chrono>
+#include<cstring>
+#include<iostream>
+#include<linux/perf_event.h>
+#include<sys/ioctl.h>
+#include<sys/syscall.h>
+
+using namespace std;
+
+/* Wall time and mispredicted branches of the same programs run with the switch
+and the threaded dispatch loop. Build with optimizations, e.g.
+cmake -DCMAKE_BUILD_TYPE=Release. Branch misses come from perf_event_open and
+are reported as n/a where the kernel does not allow it. */
+
+const int repetitions = 20;
+
+vector<pair<string, string>> programs = {
+    {"arithmetic loop", "let i = 0; let s = 0; while (i < 20000) { let s = s + i * 3 - i / 2; let i = i + 1; }; s;"},
+    {"branches", "let i = 0; let s = 0; while (i < 20000) { if (i > 10000) { let s = s + 1; } else { let s = s - 1; }; let i = i + 1; }; s;"},
+    {"calls", "let f = fn() { 1 }; let g = fn() { f() + f() }; let i = 0; let s = 0; while (i < 20000) { let s = s + g(); let i = i + 1; }; s;"},
+    {"arrays and strings", "let i = 0; let a = []; while (i < 20000) { let a = [i, \"x\" + \"y\", [i][0]]; let i = i + 1; }; a[1];"},
+};
+
+/* Counts mispredicted branches of this thread while enabled, -1 if unavailable */
+class BranchMisses {
+    int fd;
+
+    public:
+    BranchMisses() {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~BranchMisses() {
+        if (fd >= 0) close(fd);
+    }
+
+    void start() {
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    long long stop() {
+        if (fd < 0) return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        long long count = 0;
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+        return count;
+    }
+};
+
+int run(string input, bool threaded, double* ms, long long* misses, long long* executed, string* result) {
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    if (p.parseProgram(&program)) return 1;
+    auto compiler = Compiler();
+    if (compiler.compileProgram(&program)) return 1;
+    auto bytecode = compiler.getByteCode();
+    BranchMisses counter;
+    *ms = 0;
+    *misses = 0;
+    for (int r = 0; r < repetitions; r++) {
+        ByteCode copy = {bytecode.instructions, vector<unique_ptr<Object>>()};
+        for (auto& obj : bytecode.constants) copy.constants.push_back(compiler.copyConstant(obj.get()));
+        auto vm = VM(move(copy));
+        vm.threadedDispatch = threaded;
+        counter.start();
+        auto start = chrono::steady_clock::now();
+        if (vm.run()) return 1;
+        *ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / repetitions;
+        long long count = counter.stop();
+        *misses = count < 0 || *misses < 0 ? -1 : *misses + count / repetitions;
+        *executed = vm.executedInstructions;
+        *result = vm.getLastPopped().serialize();
+    }
+    return 0;
+}
+
+/* executed is 0 unless built with COUNT_INSTRUCTIONS, which timings should not include */
+string formatMisses(long long misses, long long executed) {
+    if (misses < 0) return "n/a";
+    if (executed == 0) return to_string(misses);
+    return to_string(misses) + " (" + to_string(misses * 100 / executed) + "% of instructions)";
+}
+
+int main() {
+#ifndef THREADED_DISPATCH
+    cout << "built with SWITCH_DISPATCH, both columns use the switch loop" << endl;
+#endif
+    for (auto& program : programs) {
+        double ms[2];
+        long long misses[2], executed[2];
+        string result[2];
+        for (int threaded = 0; threaded <= 1; threaded++) {
+            if (run(program.second, threaded, &ms[threaded], &misses[threaded], &executed[threaded], &result[threaded])) {
+                cout << program.first << " failed" << endl;
+                return 1;
+            }
+        }
+        if (result[0] != result[1]) {
+            cout << program.first << ": results differ, " << result[0] << " vs " << result[1] << endl;
+            return 1;
+        }
+        cout << program.first;
+        if (executed[0] > 0) cout << ", " << executed[0] << " instructions";
+        cout << ": switch -> threaded" << endl
+            << "  wall time: " << ms[0] << " -> " << ms[1] << " ms" << endl
+            << "  branch misses: " << formatMisses(misses[0], executed[0]) << " -> " << formatMisses(misses[1], executed[1]) << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include"../vm.cpp"
+#include<chrono>
+#include<iostream>
+
+using namespace std;
+
+/* Pauses of the stop-the-world and the incremental collector on programs that
+keep a large heap of arrays and hashes alive while they make garbage. Build with
+optimizations, e.g. cmake -DCMAKE_BUILD_TYPE=Release. */
+
+const double maxPauseMs = 0.5;
+
+vector<pair<string, string>> programs = {
+    {"large live arrays", "let i = 0; let big = []; while (i < 100000) { let big = [big, [i, i, i]]; let i = i + 1; }; let i = 0; let s = 0; while (i < 100000) { let s = [\"x\" + \"y\", [i]]; let i = i + 1; }; s[1];"},
+    {"large live hashes", "let i = 0; let big = {}; while (i < 50000) { let big = {1: big, 2: {i: [i]}}; let i = i + 1; }; let i = 0; let s = 0; while (i < 100000) { let s = {i: \"x\" + \"y\"}; let i = i + 1; }; s[99999];"},
+};
+
+int run(string input, bool incremental, double* ms, HeapStats* stats, string* result) {
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    if (p.parseProgram(&program)) return 1;
+    auto compiler = Compiler();
+    if (compiler.compileProgram(&program)) return 1;
+    auto vm = VM(compiler.getByteCode());
+    vm.heap.incremental = incremental;
+    vm.heap.maxPauseMs = maxPauseMs;
+    auto start = chrono::steady_clock::now();
+    if (vm.run()) return 1;
+    *ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    *stats = vm.heap.stats;
+    *result = vm.getLastPopped().serialize();
+    return 0;
+}
+
+/* Upper bound of the histogram bucket holding the p-th percentile pause */
+string percentile(const HeapStats& stats, double p) {
+    long long seen = 0;
+    for (int i = 0; i < stats.pauseHistogram.size(); i++) {
+        seen += stats.pauseHistogram.at(i);
+        if (seen >= stats.pauses * p) {
+            return i == stats.pauseHistogram.size() - 1 ? "longer" : "<" + to_string(1 << i) + "us";
+        }
+    }
+    return "n/a";
+}
+
+int main() {
+    for (auto& program : programs) {
+        double ms[2];
+        HeapStats stats[2];
+        string result[2];
+        for (int incremental = 0; incremental <= 1; incremental++) {
+            if (run(program.second, incremental, &ms[incremental], &stats[incremental], &result[incremental])) {
+                cout << program.first << " failed" << endl;
+                return 1;
+            }
+        }
+        if (result[0] != result[1]) {
+            cout << program.first << ": results differ, " << result[0] << " vs " << result[1] << endl;
+            return 1;
+        }
+        cout << program.first << ": stop-the-world -> incremental (slices of " << maxPauseMs << " ms)" << endl;
+        cout << "  wall time: " << ms[0] << " -> " << ms[1] << " ms" << endl
+            << "  collections: " << stats[0].collections << " -> " << stats[1].collections
+            << ", pauses: " << stats[0].pauses << " -> " << stats[1].pauses << endl
+            << "  max pause: " << stats[0].maxPauseMs << " -> " << stats[1].maxPauseMs << " ms"
+            << ", p99: " << percentile(stats[0], 0.99) << " -> " << percentile(stats[1], 0.99) << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include"../vm.cpp"
+#include<algorithm>
+#include<chrono>
+#include<iostream>
+#include<map>
+#include<random>
+
+using namespace std;
+
+/* Hash tables of 10^6 integer and string keys: building them, looking up every
+key in random order and iterating over the entries, with the std::map keyed by
+std::hash the HashTable object used before and with the flat tables. Build with
+optimizations, e.g. cmake -DCMAKE_BUILD_TYPE=Release. */
+
+const int entries = 1000000;
+
+/* The previous layout: an ordered map from the hash of the key to a pair allocated on its own */
+struct MapPair {
+    Value key;
+    Value value;
+};
+
+uint64_t previousHash(const Value& key) {
+    if (key.kind == IntegerValue) return hash<int>{}(key.integer);
+    return hash<string>{}(static_cast<String*>(key.object)->value);
+}
+
+struct Timings {
+    double build = 0;
+    double lookup = 0;
+    double iterate = 0;
+    long long checksum = 0;
+};
+
+template<typename F> double time(F f) {
+    auto start = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+Timings runMap(const vector<Value>& pairs, const vector<Value>& probes) {
+    Timings t;
+    map<size_t, unique_ptr<MapPair>> table;
+    t.build = time([&]() {
+        for (int i = 0; i < pairs.size(); i += 2) table[previousHash(pairs[i])] = make_unique<MapPair>(MapPair{pairs[i], pairs[i + 1]});
+    });
+    t.lookup = time([&]() {
+        for (auto& key : probes) t.checksum += table.find(previousHash(key))->second->value.integer;
+    });
+    t.iterate = time([&]() {
+        for (auto& entry : table) t.checksum += entry.second->value.integer;
+    });
+    return t;
+}
+
+template<typename Entry> Timings runFlat(const vector<Value>& pairs, const vector<Value>& probes) {
+    Timings t;
+    FlatTable<Entry> table;
+    t.build = time([&]() {
+        for (int i = 0; i < pairs.size(); i += 2) table.insert(pairs[i], pairs[i + 1]);
+    });
+    t.lookup = time([&]() {
+        for (auto& key : probes) t.checksum += table.find(key)->value.integer;
+    });
+    t.iterate = time([&]() {
+        for (auto& entry : table.entries) t.checksum += entry.value.integer;
+    });
+    return t;
+}
+
+void print(string name, const Timings& before, const Timings& after, const string& layout) {
+    cout << name << ": std::map -> " << layout << (before.checksum == after.checksum ? "" : " (checksums differ!)") << endl
+        << "  build: " << before.build << " -> " << after.build << " ms" << endl
+        << "  lookup: " << before.lookup << " -> " << after.lookup << " ms" << endl
+        << "  iterate: " << before.iterate << " -> " << after.iterate << " ms" << endl;
+}
+
+int main() {
+    Heap heap;
+    mt19937 random(42);
+    vector<Value> ints, strings;
+    for (int i = 0; i < entries; i++) {
+        Value key = integerValue((int) random());
+        ints.push_back(key);
+        ints.push_back(integerValue(i));
+        strings.push_back(heap.allocate<String>("key" + to_string(key.integer)));
+        strings.push_back(integerValue(i));
+    }
+    vector<Value> intProbes, stringProbes;
+    for (int i = 0; i < ints.size(); i += 2) {
+        intProbes.push_back(ints[i]);
+        stringProbes.push_back(strings[i]);
+    }
+    shuffle(intProbes.begin(), intProbes.end(), random);
+    shuffle(stringProbes.begin(), stringProbes.end(), random);
+
+    cout << entries << " entries" << endl;
+    print("integer keys", runMap(ints, intProbes), runFlat<IntEntry>(ints, intProbes), "int entries");
+    print("integer keys", runMap(ints, intProbes), runFlat<ValueEntry>(ints, intProbes), "value entries");
+    print("string keys", runMap(strings, stringProbes), runFlat<StringEntry>(strings, stringProbes), "string entries");
+    print("string keys", runMap(strings, stringProbes), runFlat<ValueEntry>(strings, stringProbes), "value entries");
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include"../session.cpp"
+#include<algorithm>
+#include<chrono>
+#include<iostream>
+
+using namespace std;
+
+/* Latency from input to result of a long REPL session. Per-line latency should
+not depend on how many lines came before. Build with optimizations, e.g.
+cmake -DCMAKE_BUILD_TYPE=Release. */
+
+const int sessionLines = 20000;
+const int windowLines = 2000;
+const int distinctNames = 2000; // globals are rebound once every name is used
+
+string name(int i) {
+    string res = "";
+    for (i %= distinctNames; ; i /= 26) {
+        res += (char) ('a' + i % 26);
+        if (i < 26) break;
+    }
+    return res;
+}
+
+string line(int i) {
+    string v = "val" + name(i / 4), f = "func" + name(i / 4);
+    switch (i % 4) {
+        case 0: return "let " + v + " = " + to_string(i) + ";";
+        case 1: return "let " + f + " = fn() { if (" + v + " > 10) { " + v + " * 2 } else { [" + v + ", \"small\"] } };";
+        case 2: return f + "()";
+        default: return "let i = 0; while (i < 10) { let i = i + 1; }; " + v + " + i";
+    }
+}
+
+void report(string label, vector<double> latencies) {
+    sort(latencies.begin(), latencies.end());
+    double p50 = latencies.at(latencies.size() / 2);
+    double p99 = latencies.at(latencies.size() * 99 / 100);
+    cout << label << ": p50 " << p50 << " us, p99 " << p99 << " us" << endl;
+}
+
+int main() {
+    auto session = Session();
+    vector<double> latencies;
+    for (int i = 0; i < sessionLines; i++) {
+        string input = line(i), result;
+        auto start = chrono::steady_clock::now();
+        if (session.eval(input, &result)) {
+            cout << "line " << i << " failed: " << input << endl;
+            return 1;
+        }
+        latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+    }
+    report("first " + to_string(windowLines) + " lines", vector<double>(latencies.begin(), latencies.begin() + windowLines));
+    report("last " + to_string(windowLines) + " lines", vector<double>(latencies.end() - windowLines, latencies.end()));
+    return 0;
+}
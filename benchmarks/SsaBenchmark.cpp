@@ -0,0 +1,63 @@
+#include"../vm.cpp"
+#include<chrono>
+#include<iostream>
+
+using namespace std;
+
+/* Executed instructions and wall time of the same programs compiled at
+optimization levels 1 and 2. Build with optimizations, e.g.
+cmake -DCMAKE_BUILD_TYPE=Release. */
+
+const int repetitions = 20;
+
+vector<pair<string, string>> programs = {
+    {"repeated subexpressions", "let i = 0; let s = 0; while (i < 20000) { let s = s + i * i * i + i * i * i; let i = i + 1; }; s;"},
+    {"copies and dead values", "let i = 0; let a = 0; while (i < 20000) { let a = i; let b = a; i * 2; let i = i + 1; }; a;"},
+    {"inlined calls", "let n = 7; let f = fn() { n * n + n }; let i = 0; let s = 0; while (i < 20000) { let s = s + f() - f(); let i = i + 1; }; s;"},
+    {"branches", "let n = 9; let k = 3; let f = fn() { let i = 0; let s = 0; while (i < 20000) { if (i > n * n * k) { let s = s + n * n * k; } else { let s = s - 1; }; let i = i + 1; }; s }; f();"},
+};
+
+int run(string input, int level, long long* executed, double* ms, string* result) {
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    if (p.parseProgram(&program)) return 1;
+    CompilerOptions options;
+    options.optimizationLevel = level;
+    auto compiler = Compiler(options);
+    if (compiler.compileProgram(&program)) return 1;
+    auto bytecode = compiler.getByteCode();
+    *ms = 0;
+    for (int r = 0; r < repetitions; r++) {
+        ByteCode copy = {bytecode.instructions, vector<unique_ptr<Object>>()};
+        for (auto& obj : bytecode.constants) copy.constants.push_back(compiler.copyConstant(obj.get()));
+        auto vm = VM(move(copy));
+        auto start = chrono::steady_clock::now();
+        if (vm.run()) return 1;
+        *ms += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / repetitions;
+        *executed = vm.executedInstructions;
+        *result = vm.getLastPopped().serialize();
+    }
+    return 0;
+}
+
+int main() {
+    for (auto& program : programs) {
+        long long executed[2];
+        double ms[2];
+        string result[2];
+        for (int level = 1; level <= 2; level++) {
+            if (run(program.second, level, &executed[level - 1], &ms[level - 1], &result[level - 1])) {
+                cout << program.first << " failed at level " << level << endl;
+                return 1;
+            }
+        }
+        if (result[0] != result[1]) {
+            cout << program.first << ": results differ, " << result[0] << " vs " << result[1] << endl;
+            return 1;
+        }
+        cout << program.first << ": " << executed[0] << " -> " << executed[1] << " instructions, "
+            << ms[0] << " -> " << ms[1] << " ms" << endl;
+    }
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include<map>
 #include<initializer_list>
 #include<sstream>
+#include<cstdint>
 
 using namespace std;
 
@@ -14,137 +15,353 @@ typedef vector<byte> Instruction;
 
 typedef byte OpCode;
 
-// class Iota {
-//     private:
-//     // byte counter;
-//     unsigned char counter;
-//     byte* id;
-
-//     public:
-//     Iota() {
-//         counter = 0;
-//     }
-//     byte next() {
-//         byte temp{counter++};
-//         *id = temp;
-//         return *id;
-//     }
-// };
-// unique_ptr<Iota> incrementor = make_unique<Iota>();
-const OpCode OpConstant{0};
-const OpCode OpAdd{1};
-const OpCode OpPop{2};
-const OpCode OpMul{3};
-const OpCode OpSub{4};
-const OpCode OpDiv{5};
-const OpCode OpTrue{6};
-const OpCode OpFalse{7};
-const OpCode OpEq{8};
-const OpCode OpNeq{9};
-const OpCode OpGt{10};
-const OpCode OpMinus{11};
-const OpCode OpSurprise{12};
-const OpCode OpJumpIfFalse{13};
-const OpCode OpJump{14};
-const OpCode OpNull{15};
-const OpCode OpSetGlobal{16};
-const OpCode OpGetGlobal{17};
-const OpCode OpArray{18};
-const OpCode OpHash{19};
-const OpCode OpIndex{20};
-const OpCode OpCall{21};
-const OpCode OpRetVal{22};
-const OpCode OpRet{23};
-
-
-// add definitions for debug purpose
+/* The opcode table, one line per opcode in numbering order. The numbers are part
+of the image format, so new opcodes go at the end. Columns: operand count, unprefixed
+operand width in bytes (every OpWide prefix doubles it, up to 4), operands are
+signed offsets from the end of the instruction, stack slots popped and pushed
+(-1: given by the operand). */
+#define OPCODES(X) \
+    X(OpConstant,    1, 1, false, 0, 1) \
+    X(OpAdd,         0, 0, false, 2, 1) \
+    X(OpPop,         0, 0, false, 1, 0) \
+    X(OpMul,         0, 0, false, 2, 1) \
+    X(OpSub,         0, 0, false, 2, 1) \
+    X(OpDiv,         0, 0, false, 2, 1) \
+    X(OpTrue,        0, 0, false, 0, 1) \
+    X(OpFalse,       0, 0, false, 0, 1) \
+    X(OpEq,          0, 0, false, 2, 1) \
+    X(OpNeq,         0, 0, false, 2, 1) \
+    X(OpGt,          0, 0, false, 2, 1) \
+    X(OpMinus,       0, 0, false, 1, 1) \
+    X(OpSurprise,    0, 0, false, 1, 1) \
+    X(OpJumpIfFalse, 1, 2, true,  1, 0) \
+    X(OpJump,        1, 2, true,  0, 0) \
+    X(OpNull,        0, 0, false, 0, 1) \
+    X(OpSetGlobal,   1, 1, false, 1, 0) \
+    X(OpGetGlobal,   1, 1, false, 0, 1) \
+    X(OpArray,       1, 1, false, -1, 1) \
+    X(OpHash,        1, 1, false, -1, 1) \
+    X(OpIndex,       0, 0, false, 2, 1) \
+    X(OpCall,        0, 0, false, 1, 1) /* the function stays below the callee's frame until it returns */ \
+    X(OpRetVal,      0, 0, false, 1, 0) \
+    X(OpRet,         0, 0, false, 0, 0) \
+    X(OpWide,        0, 0, false, 0, 0) /* prefix: doubles the operand width of the next instruction */ \
+    X(OpLoop,        1, 2, true,  0, 0) /* backward jump closing a loop */ \
+    X(OpAddInt,      0, 0, false, 2, 1) /* arithmetic on operands the compiler proved to be integers */ \
+    X(OpSubInt,      0, 0, false, 2, 1) \
+    X(OpMulInt,      0, 0, false, 2, 1) \
+    X(OpDivInt,      0, 0, false, 2, 1)
+
+enum OpCodeNumber : unsigned char {
+#define OPCODE_NUMBER(name, ...) name##Number,
+    OPCODES(OPCODE_NUMBER)
+#undef OPCODE_NUMBER
+    numOpCodes
+};
+
+#define OPCODE_CONSTANT(name, ...) constexpr OpCode name{name##Number};
+OPCODES(OPCODE_CONSTANT)
+#undef OPCODE_CONSTANT
+static_assert(numOpCodes == 30, "opcode set changed: bump imageVersion in image.cpp, then this count");
+
 struct Definition {
-    string name;
-    vector<int> operandWidths;
+    const char* name;
+    int operandCount;
+    int operandWidth; // unprefixed width of every operand
+    bool relative; // operands are signed offsets from the end of the instruction
+    int pops; // -1 if given by the operand
+    int pushes;
 };
-map<OpCode, Definition> defs = {
-    {OpConstant, {"OpConstant", vector<int>{4}}},
-    {OpAdd, {"OpAdd", vector<int>{}}}, // no operands
-    {OpMul, {"OpMul", vector<int>{}}},
-    {OpSub, {"OpSub", vector<int>{}}},
-    {OpDiv, {"OpDiv", vector<int>{}}},
-    {OpPop, {"OpPop", vector<int>{}}},
-    {OpTrue, {"OpTrue", vector<int>{}}},
-    {OpFalse, {"OpFalse", vector<int>{}}},
-    {OpEq, {"OpEq", vector<int>{}}},
-    {OpNeq, {"OpNeq", vector<int>{}}},
-    {OpGt, {"OpGt", vector<int>{}}},
-    {OpMinus, {"OpMinus", vector<int>{}}},
-    {OpSurprise, {"OpSurprise", vector<int>{}}},
-    {OpJumpIfFalse, {"OpJumpIfFalse", vector<int>{4}}},
-    {OpJump, {"OpJump", vector<int>{4}}},
-    {OpNull, {"OpNull", vector<int>{}}},
-    {OpGetGlobal, {"OpGetGlobal", vector<int>{4}}},
-    {OpSetGlobal, {"OpSetGlobal", vector<int>{4}}},
-    {OpArray, {"OpArray", vector<int>{4}}},
-    {OpHash, {"OpHash", vector<int>{4}}},
-    {OpIndex, {"OpIndex", vector<int>{}}},
-    {OpCall, {"OpCall", vector<int>{}}},
-    {OpRetVal, {"OpRetVal", vector<int>{}}},
-    {OpRet, {"OpRet", vector<int>{}}}
+
+/* Array-indexed by opcode; check lookup first for bytes that may not be opcodes */
+struct DefinitionTable {
+    Definition entries[numOpCodes];
+
+    constexpr const Definition& operator[](OpCode opcode) const {
+        return entries[(int) opcode];
+    }
 };
-int lookup(byte opcode) {
-    return defs.count(opcode) > 0 ? 0 : 1;
+
+constexpr DefinitionTable defs = {{
+#define OPCODE_DEFINITION(name, count, width, relative, pops, pushes) {#name, count, width, relative, pops, pushes},
+    OPCODES(OPCODE_DEFINITION)
+#undef OPCODE_DEFINITION
+}};
+
+constexpr int lookup(byte opcode) {
+    return (int) opcode < numOpCodes ? 0 : 1;
 }
 
 /******************** construct and destruct byte code *******************/
-vector<byte> constructByteCode(OpCode opcode, vector<int> operands) {
-    auto def = defs.find(opcode);
-    if (def == defs.end()) return vector<byte>(); // return empty vector when opcode not found, potential risk
+const int maxOperandWidth = 4;
+
+/* Whether operand fits in width bytes, signed for relative operands */
+bool fitsWidth(int operand, int width, bool relative) {
+    if (width >= maxOperandWidth) return true;
+    long bound = 1L << (8 * width);
+    if (relative) return -bound / 2 <= operand && operand < bound / 2;
+    return 0 <= operand && operand < bound;
+}
 
-    // Calculate instruction length
-    int instructLen = 1;
-    for (int w : def->second.operandWidths) {
-        instructLen += w;
+/* Number of OpWide prefixes needed to encode operands */
+int wideLevel(const Definition& def, const vector<int>& operands) {
+    int wide = 0;
+    for (int i = 0; i < operands.size(); i++) {
+        while (!fitsWidth(operands.at(i), def.operandWidth << wide, def.relative)) wide++;
     }
-    vector<byte> instruction = {opcode};
-    int idx = 0;
+    return wide;
+}
+
+constexpr int operandWidth(const Definition& def, int wide) {
+    return min(def.operandWidth << wide, maxOperandWidth);
+}
+
+vector<byte> constructByteCode(OpCode opcode, vector<int> operands, int minWide = 0) {
+    if (lookup(opcode)) return vector<byte>(); // return empty vector when opcode not found, potential risk
+    const Definition& def = defs[opcode];
+
+    int wide = max(minWide, wideLevel(def, operands));
+    vector<byte> instruction = vector<byte>(wide, OpWide);
+    instruction.push_back(opcode);
     for (auto operand : operands) {
-        int width = def->second.operandWidths.at(idx++);
-        if (width == 4) { // integer
-            for (int i = 3; i >= 0; i--) {
-                byte b = (byte) ((operand >> (8 * i)) & 0xFF);
-                // cout << "bit " << 4 - i << "of OpConst is: " << (int) b << endl;
-                instruction.push_back(b);
-            }
-            // cout << (unsigned int) bytes[0] << endl;
+        int width = operandWidth(def, wide);
+        for (int i = width - 1; i >= 0; i--) {
+            instruction.push_back((byte) ((operand >> (8 * i)) & 0xFF));
         }
     }
     return instruction;
 }
 
-pair<vector<int>, int> destructOperandsByteCode(Definition def, vector<byte> bytecode, int offset) {
+/* Read a big-endian unsigned operand of 1, 2 or 4 bytes */
+int readOperand(const Instruction& bytecode, int offset, int width) {
+    int operand = 0;
+    for (int i = 0; i < width; i++) {
+        operand = (operand << 8) | (int) bytecode.at(offset + i);
+    }
+    return operand;
+}
+
+/* Read a big-endian signed jump offset of 2 or 4 bytes */
+int readOffset(const Instruction& bytecode, int offset, int width) {
+    int operand = readOperand(bytecode, offset, width);
+    if (width == 2) return (int16_t) operand;
+    return operand;
+}
+
+pair<vector<int>, int> destructOperandsByteCode(const Definition& def, const Instruction& bytecode, int offset, int wide = 0) {
     vector<int> operands = {};
     int byteCount = 0;
-    for (int i = 0; i < def.operandWidths.size(); i++) {
-        int width = def.operandWidths.at(i);
-        if (width == 4) {
-            int operand = 0;
-            for (int i = 0; i < 4; i++) {
-                operand = (operand << 8) | (int) bytecode.at(offset++);
-            }
-            operands.push_back(operand);
-        }
+    for (int i = 0; i < def.operandCount; i++) {
+        int width = operandWidth(def, wide);
+        if (def.relative) operands.push_back(readOffset(bytecode, offset, width));
+        else operands.push_back(readOperand(bytecode, offset, width));
+        offset += width;
         byteCount += width;
     }
-    // assert(operands.size() == def.operandWidths.size());
+    // assert(operands.size() == def.operandCount);
     return pair<vector<int>, int>{move(operands), byteCount};
 }
 
-/******************** debug print statements *******************/
-string formatInstruction(Definition definition, vector<int>& operands) {
-    std::ostringstream buffer;
-    buffer << definition.name;
-    for (int operand : operands) {
-        buffer << " " << operand;
+/* Total length in bytes of the instruction at offset, including OpWide prefixes */
+int instructionLength(const Instruction& bytecode, int offset) {
+    int start = offset;
+    int wide = 0;
+    while (bytecode.at(offset) == OpWide) {
+        wide++;
+        offset++;
     }
-    return buffer.str();
+    if (lookup(bytecode.at(offset))) return 0;
+    const Definition& def = defs[bytecode.at(offset)];
+    return offset - start + 1 + def.operandCount * operandWidth(def, wide);
+}
+
+/******************** source positions *******************/
+struct SourcePos {
+    int line = 0; // 0 if the instruction does not come from the source
+    int column = 0;
+};
+
+bool operator==(const SourcePos& a, const SourcePos& b) {
+    return a.line == b.line && a.column == b.column;
+}
+
+/* Maps instruction offsets to source positions. One entry per instruction whose
+position differs from the one before it: the offset delta, then the line and column
+deltas, each an unsigned LEB128 varint (line and column zigzag encoded). */
+typedef vector<byte> PositionTable;
+
+void writeVarint(PositionTable& table, unsigned int value) {
+    while (value >= 0x80) {
+        table.push_back((byte) ((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    table.push_back((byte) value);
+}
+
+unsigned int readVarint(const PositionTable& table, int& idx) {
+    unsigned int value = 0;
+    for (int shift = 0; idx < table.size(); shift += 7) {
+        unsigned int b = (unsigned int) table.at(idx++);
+        value |= (b & 0x7F) << shift;
+        if (b < 0x80) break;
+    }
+    return value;
+}
+
+unsigned int zigzag(int value) {
+    return ((unsigned int) value << 1) ^ (unsigned int) (value >> 31);
+}
+
+int unzigzag(unsigned int value) {
+    return (int) (value >> 1) ^ -(int) (value & 1);
 }
+
+/* positions holds one entry per byte of instructions; the first byte of each instruction counts */
+PositionTable encodePositions(const Instruction& instructions, const vector<SourcePos>& positions) {
+    PositionTable table;
+    int lastOffset = 0;
+    SourcePos last;
+    for (int offset = 0; offset < instructions.size(); offset += instructionLength(instructions, offset)) {
+        SourcePos pos = positions.at(offset);
+        if (pos == last) continue;
+        writeVarint(table, offset - lastOffset);
+        writeVarint(table, zigzag(pos.line - last.line));
+        writeVarint(table, zigzag(pos.column - last.column));
+        lastOffset = offset;
+        last = pos;
+    }
+    return table;
+}
+
+/* (offset, position) for every entry of the table */
+vector<pair<int, SourcePos>> decodePositions(const PositionTable& table) {
+    vector<pair<int, SourcePos>> res;
+    int idx = 0, offset = 0;
+    SourcePos pos;
+    while (idx < table.size()) {
+        offset += readVarint(table, idx);
+        pos.line += unzigzag(readVarint(table, idx));
+        pos.column += unzigzag(readVarint(table, idx));
+        res.push_back(make_pair(offset, pos));
+    }
+    return res;
+}
+
+/* Position of the instruction at offset */
+SourcePos lookupPosition(const PositionTable& table, int offset) {
+    SourcePos res;
+    for (auto& entry : decodePositions(table)) {
+        if (entry.first > offset) break;
+        res = entry.second;
+    }
+    return res;
+}
+
+/* One position per byte of code size bytes long, the form the compiler works on */
+vector<SourcePos> expandPositions(const PositionTable& table, int size) {
+    vector<SourcePos> res(size);
+    auto entries = decodePositions(table);
+    for (int i = 0; i < entries.size(); i++) {
+        int end = i + 1 < entries.size() ? entries.at(i + 1).first : size;
+        for (int offset = entries.at(i).first; offset < end && offset < size; offset++) res.at(offset) = entries.at(i).second;
+    }
+    return res;
+}
+
+/******************** instruction iterator *******************/
+constexpr int maxOperands = 1;
+#define OPCODE_OPERAND_CHECK(name, count, ...) static_assert(count <= maxOperands, #name " has too many operands");
+OPCODES(OPCODE_OPERAND_CHECK)
+#undef OPCODE_OPERAND_CHECK
+
+/* An instruction decoded in place. Invalid instructions (unknown opcode, or
+operands running past the end of the code) cover the rest of the code. */
+struct DecodedInstruction {
+    int offset; // of the first byte, OpWide prefixes included
+    int length;
+    OpCode opcode;
+    int wide;
+    int operandCount;
+    int operands[maxOperands];
+    bool valid;
+};
+
+/* Forward iterator over code it does not own; the code must outlive it */
+class InstructionIterator {
+    const byte* code;
+    int size;
+    DecodedInstruction current;
+
+    void decode(int offset) {
+        current = DecodedInstruction{offset, 0, OpWide, 0, 0, {}, false};
+        if (offset >= size) return;
+        int pos = offset;
+        while (pos < size && code[pos] == OpWide) pos++;
+        current.wide = pos - offset;
+        if (pos == size || lookup(code[pos])) {
+            current.opcode = pos == size ? OpWide : code[pos];
+            current.length = size - offset;
+            return;
+        }
+        current.opcode = code[pos++];
+        const Definition& def = defs[current.opcode];
+        int width = operandWidth(def, current.wide);
+        if (pos + def.operandCount * width > size) {
+            current.length = size - offset;
+            return;
+        }
+        for (int i = 0; i < def.operandCount; i++, pos += width) {
+            unsigned int operand = 0;
+            for (int b = 0; b < width; b++) operand = (operand << 8) | (unsigned int) code[pos + b];
+            if (def.relative && width == 2) current.operands[i] = (int16_t) operand;
+            else current.operands[i] = (int) operand;
+        }
+        current.operandCount = def.operandCount;
+        current.length = pos - offset;
+        current.valid = true;
+    }
+
+    public:
+    InstructionIterator(const byte* code, int size, int offset) : code(code), size(size) {
+        decode(offset);
+    }
+
+    const DecodedInstruction& operator*() const {
+        return current;
+    }
+
+    const DecodedInstruction* operator->() const {
+        return &current;
+    }
+
+    InstructionIterator& operator++() {
+        decode(current.offset + current.length);
+        return *this;
+    }
+
+    bool operator!=(const InstructionIterator& other) const {
+        return current.offset != other.current.offset;
+    }
+};
+
+/* The instructions of a code buffer, for range-for loops */
+struct InstructionRange {
+    const byte* code;
+    int size;
+
+    InstructionRange(const byte* code, int size) : code(code), size(size) {};
+    InstructionRange(const Instruction& instructions) : code(instructions.data()), size(instructions.size()) {};
+
+    InstructionIterator begin() const {
+        return InstructionIterator(code, size, 0);
+    }
+
+    InstructionIterator end() const {
+        return InstructionIterator(code, size, size);
+    }
+};
+
+/******************** debug print statements *******************/
 string formatByteCount(int byteCount) {
     string str = to_string(byteCount);
     int length = str.length();
@@ -154,25 +371,30 @@ string formatByteCount(int byteCount) {
     return str;
 };
 
-string serialize(Instruction instruction) {
-    int byteCount = 0;
-    Definition def;
-    ostringstream buffer;
-    while (byteCount < instruction.size()) {
-        if (lookup(instruction.at(byteCount))) {
-            cout << "lookup: no instruction found" <<endl;
-            return "";
+/* Streaming disassembler, one "offset [OpWide...] name operands" line per instruction.
+Returns 1 at the first invalid instruction, after writing what came before it. */
+int disassemble(ostream& out, InstructionRange range) {
+    bool first = true;
+    for (auto& ins : range) {
+        if (!first) out << "\n";
+        first = false;
+        if (!ins.valid) {
+            out << formatByteCount(ins.offset) << " invalid";
+            return 1;
         }
-        else {
-            def = defs[instruction.at(byteCount)];
-            buffer << formatByteCount(byteCount) << " ";
-            byteCount++;
-        };
-        auto pair = destructOperandsByteCode(def, instruction, byteCount);
-        buffer << formatInstruction(def, pair.first);
-        byteCount += pair.second;
-        if (byteCount < instruction.size()) buffer << "\n";
+        out << formatByteCount(ins.offset) << " ";
+        for (int i = 0; i < ins.wide; i++) out << defs[OpWide].name << " ";
+        out << defs[ins.opcode].name;
+        for (int i = 0; i < ins.operandCount; i++) out << " " << ins.operands[i];
     }
-    return buffer.str();
+    return 0;
 }
 
+string serialize(const Instruction& instruction) {
+    ostringstream buffer;
+    if (disassemble(buffer, InstructionRange(instruction))) {
+        cout << "lookup: no instruction found" << endl;
+        return "";
+    }
+    return buffer.str();
+}
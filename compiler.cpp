@@ -1,10 +1,19 @@
 #include"object.cpp"
+#include"optimizer.cpp"
+#include"ssa.cpp"
 #include"parser.cpp"
 #include"symbol.cpp"
+#include<atomic>
+#include<functional>
+#include<future>
+#include<set>
+#include<thread>
 
 struct ByteCode {
     Instruction instructions;
     vector<unique_ptr<Object>> constants;
+    PositionTable positions; // of the main program
+    int maxStack = -1; // deepest operand stack of the main program, -1 if unknown
 };
 
 struct EmittedInstruction {
@@ -12,10 +21,58 @@ struct EmittedInstruction {
     int ip;
 };
 
+const string anyType = "ANY"; // static type of values whose type is not known at compile time
+
+struct CompilerOptions {
+    int optimizationLevel = 1; // 0: none, 1: dead code, inlining and integer opcodes, 2: also the SSA passes
+    int inlineBudget = 32; // largest callee, in instruction bytes, inlined at a call site; 0 disables inlining
+    bool inlineReport = false;
+    int compileThreads = thread::hardware_concurrency(); // function bodies are compiled in parallel when > 1
+    bool incremental = false; // programs arrive in pieces (REPL session), so globals may be rebound later
+};
+
+struct InlineDecision {
+    string callee;
+    bool inlined;
+    string reason;
+};
+
+/* A global referenced or defined while compiling a fragment. Fragments number
+globals by name in order of first use and use that as the operand of
+OpGetGlobal/OpSetGlobal. */
+struct GlobalRef {
+    int name; // index in the fragment's global names
+    bool define;
+    int fnConst; // fragment constant of the fn literal bound by a define, or -1
+};
+
+/* What the compiler knows about globals after the last program handed out by
+takeByteCode, to go back to when the next one fails to compile */
+struct GlobalsCheckpoint {
+    map<string, int> symbols; // name -> global index
+    int numDefs = 0;
+    map<string, int> bindingCounts;
+    map<int, int> knownFunctions;
+    map<string, string> globalTypes;
+};
+
+/* A function body compiled apart from the program: constant indices are local
+to constants and global operands index globalNames */
+struct FunctionFragment {
+    int err;
+    Instruction instructions;
+    vector<SourcePos> positions;
+    vector<unique_ptr<Object>> constants;
+    vector<string> globalNames;
+    vector<GlobalRef> globalRefs;
+    vector<InlineDecision> inlineDecisions;
+};
+
 struct CompilationScope {
     Instruction instructions;
     EmittedInstruction last;
     EmittedInstruction prevLast;
+    vector<SourcePos> positions; // one per byte of instructions
 };
 
 class Compiler {
@@ -23,12 +80,27 @@ class Compiler {
     Instruction instructions;
     vector<unique_ptr<Object>> constants;
     SymbolTable symbolTable;
+    CompilerOptions options;
+    map<string, int> bindingCounts; // number of let statements binding each name
+    map<int, int> knownFunctions; // global index -> constant index, for globals bound once to a fn literal
+    map<string, string> globalTypes; // inferred static type of each global
+    bool fragment = false; // compiling a function body on a worker thread
+    vector<string> globalNames; // fragment only
+    map<string, int> globalNameIds; // fragment only
+    vector<GlobalRef> globalRefs; // fragment only
+    map<int, int> tempGlobals; // global index -> number of an SSA temporary
+    map<FnLiteral*, future<FunctionFragment>> pendingFunctions; // bodies being compiled by workers
+    int emittedConstants = 0; // constants already handed out by takeByteCode
+    GlobalsCheckpoint emittedGlobals; // globals as of that program
+    vector<int> smallIntegers = vector<int>(smallIntegerMax - smallIntegerMin + 1, -1); // constant index of each small integer, or -1
+    SourcePos position; // of the node being compiled, given to every instruction emitted
 
     public:
     vector<unique_ptr<CompilationScope>> scopes;
     int scopeIndex;
+    vector<InlineDecision> inlineDecisions;
 
-    Compiler() {
+    Compiler(CompilerOptions options = CompilerOptions()) : options(options) {
         symbolTable = SymbolTable();
         auto scope = CompilationScope{Instruction{}, EmittedInstruction{}, EmittedInstruction{}};
         scopes.push_back(make_unique<CompilationScope>(scope));
@@ -61,6 +133,7 @@ class Compiler {
         if (scope->last.opcode == opcode) {
             auto prevLast = scope->prevLast;
             scope->instructions.pop_back();
+            scope->positions.pop_back();
             scope->last = prevLast;
         }
         return 0;
@@ -85,41 +158,124 @@ class Compiler {
         return 0;
     }
 
-    void changeOperand(int ip, vector<int> operand) {
+    /* Re-encode the instruction at ip with a new operand. If the operand no longer
+    fits, the instruction is widened in place; relative jumps that span the whole
+    widened instruction stay valid, but one that ends right behind it does not, so
+    two jumps patched against each other are patched until neither grows, see
+    closeLoop and compileIfExpression. */
+    int changeOperand(int ip, vector<int> operand) {
         auto scope = getCurrScope();
-        auto opcode = OpCode(scope->instructions.at(ip));
-        auto newInstruction = constructByteCode(opcode, operand);
+        int len = instructionLength(scope->instructions, ip);
+        if (len == 0) return 1; // no instruction at ip
+        int wide = 0;
+        while (scope->instructions.at(ip + wide) == OpWide) wide++;
+        auto opcode = OpCode(scope->instructions.at(ip + wide));
+        auto newInstruction = constructByteCode(opcode, operand, wide);
+        int growth = newInstruction.size() - len;
+        if (growth > 0) {
+            scope->instructions.insert(scope->instructions.begin() + ip, growth, OpWide);
+            scope->positions.insert(scope->positions.begin() + ip, growth, scope->positions.at(ip));
+            if (scope->last.ip > ip) scope->last.ip += growth;
+            if (scope->prevLast.ip > ip) scope->prevLast.ip += growth;
+        }
         // replace instruction
         for (int i = 0; i < newInstruction.size(); i++) {
             scope->instructions.at(ip + i) = newInstruction.at(i);
         }
+        return 0;
+    }
+
+    /* Emit the back edge to loopStart and point the loop exit at posExit past it.
+    Widening either jump moves the other, so re-patch both until neither grows. */
+    int closeLoop(int loopStart, int posExit) {
+        int posLoop = emit(OpLoop, vector<int>{0});
+        int size = -1;
+        while (size != getCurrScope()->instructions.size()) {
+            size = getCurrScope()->instructions.size();
+            int len = instructionLength(getCurrScope()->instructions, posLoop);
+            if (changeOperand(posLoop, vector<int>{loopStart - (posLoop + len)})) return 1;
+            if (patchJump(posExit)) return 1;
+            posLoop = getCurrScope()->last.ip;
+        }
+        return 0;
+    }
+
+    /* Point the jump at ip to the end of the current instructions */
+    int patchJump(int ip) {
+        return patchJumpTo(ip, getCurrScope()->instructions.size());
+    }
+
+    int patchJumpTo(int ip, int target) {
+        int offset = target - (ip + instructionLength(getCurrScope()->instructions, ip));
+        return changeOperand(ip, vector<int>{offset});
+    }
+
+    /* Position of the token a node was parsed from, or the enclosing one's */
+    SourcePos nodePosition(Node* node) {
+        Token token = node->getToken();
+        return token.line > 0 ? SourcePos{token.line, token.column} : position;
     }
 
     template<typename T> int compile(unique_ptr<T> node) {
+        SourcePos outer = position;
+        position = nodePosition(node.get());
+        int err = compileNode(move(node));
+        position = outer;
+        return err;
+    }
+
+    template<typename T> int compileNode(unique_ptr<T> node) {
         string type = node.get()->getType();
         if (type == ntypes.Identifier) {
             Identifier* ident = dynamic_cast<Identifier*>(node.get());
+            if (fragment) {
+                emit(OpGetGlobal, vector<int>{fragmentGlobal(ident->value, false, -1)});
+                return 0;
+            }
+            if (symbolTable.resolve(ident->value) == nullptr) return 1; // undefined identifier
             emit(OpGetGlobal, vector<int>{symbolTable.resolve(ident->value).get()->index});
         }
         else if (type == ntypes.LetStatement) {
             LetStatement* stmt = dynamic_cast<LetStatement*>(node.get());
+            bool isFn = stmt->value != nullptr && stmt->value->getType() == ntypes.FnLiteral;
             if (compile(move(stmt->value))) return 1; // failed to compile let statement expression
             // store to symbol table
-            emit(OpSetGlobal, vector<int>{symbolTable.define(stmt->identifier.value).get()->index});
+            string name = stmt->identifier.value;
+            bool known = isFn && bindingCount(name) == 1 && !options.incremental;
+            if (fragment) {
+                emit(OpSetGlobal, vector<int>{fragmentGlobal(name, true, known ? (int) constants.size() - 1 : -1)});
+                return 0;
+            }
+            int index = defineGlobal(name);
+            emit(OpSetGlobal, vector<int>{index});
+            if (known) {
+                knownFunctions[index] = constants.size() - 1; // the fn literal is the last constant added
+            }
         }
         else if (type == ntypes.FnLiteral) {
             FnLiteral* fn = dynamic_cast<FnLiteral*>(node.get());
-            enterScope();
-            if (compile(move(fn->body))) return 1; // failed to compile func body
-            if (replaceIfLastIs(OpPop, OpRetVal)) return 1; // failed to replace pop instruction with return instruction
-            if (addIfLastIsNot(OpRetVal, OpRet)); // handle empty function
-            auto instructions = leaveScope();
-            auto compiledFn = CompiledFunction(instructions);
+            Instruction instructions;
+            vector<SourcePos> positions;
+            if (pendingFunctions.count(fn)) {
+                if (spliceFragment(pendingFunctions.at(fn).get(), &instructions, &positions)) return 1;
+            } else if (compileFunctionBody(fn, &instructions, &positions)) {
+                return 1; // failed to compile func body
+            }
+            auto compiledFn = CompiledFunction(instructions, encodePositions(instructions, positions));
+            compiledFn.maxStack = frameSize(instructions, true);
             int constIdx = addConstant(make_unique<CompiledFunction>(compiledFn));
             emit(OpConstant, vector<int>{constIdx});
         }
         else if (type == ntypes.CallExpression) {
             CallExpression* exp = dynamic_cast<CallExpression*>(node.get());
+            if (exp->function != nullptr && exp->function->getType() == ntypes.Identifier) {
+                Identifier* ident = dynamic_cast<Identifier*>(exp->function.get());
+                int constIdx = inlineCandidate(ident->value);
+                if (constIdx >= 0) {
+                    emitInlined(constIdx);
+                    return 0;
+                }
+            }
             if (compile(move(exp->function))) return 1; // failed to compile function of function call
             emit(OpCall, vector<int>{});
         }
@@ -128,6 +284,14 @@ class Compiler {
             if (compile(move(stmt->value))) return 1; // failed to compile return statement
             emit(OpRetVal, vector<int>{});
         }
+        else if (type == ntypes.WhileStatement) {
+            WhileStatement* stmt = dynamic_cast<WhileStatement*>(node.get());
+            int loopStart = getCurrScope()->instructions.size();
+            if (compile(move(stmt->condition))) return 1; // failed to compile loop condition
+            int posExit = emit(OpJumpIfFalse, vector<int>{-1}); // fix later
+            if (compileStatements(stmt->body->statements, false)) return 1; // failed to compile loop body
+            if (closeLoop(loopStart, posExit)) return 1;
+        }
         else if (type == ntypes.ExpressionStatement) {
             ExpressionStatement* stmt = dynamic_cast<ExpressionStatement*>(node.get());
             if (compile(move(stmt->expression))) return 1;
@@ -144,6 +308,7 @@ class Compiler {
         }
         else if (type == ntypes.InfixExpression) {
             InfixExpression* exp = dynamic_cast<InfixExpression*>(node.get());
+            bool ints = options.optimizationLevel >= 1 && inferType(exp->left.get()) == objs.INTEGER_OBJ && inferType(exp->right.get()) == objs.INTEGER_OBJ;
             if (exp->Operator == "<") {
                 if (compile(move(exp->right))) return 1;
                 if (compile(move(exp->left))) return 1;
@@ -153,14 +318,15 @@ class Compiler {
             if (compile(move(exp->left))) return 1;
             if (compile(move(exp->right))) return 1;
 
+            // operands proven to be integers get opcodes without runtime type checks
             if (exp->Operator == "+") {
-                emit(OpAdd, vector<int>{});
+                emit(ints ? OpAddInt : OpAdd, vector<int>{});
             } else if (exp->Operator == "-") {
-                emit(OpSub, vector<int>{});
+                emit(ints ? OpSubInt : OpSub, vector<int>{});
             } else if (exp->Operator == "*") {
-                emit(OpMul, vector<int>{});
+                emit(ints ? OpMulInt : OpMul, vector<int>{});
             } else if (exp->Operator == "/") {
-                emit(OpDiv, vector<int>{});
+                emit(ints ? OpDivInt : OpDiv, vector<int>{});
             } else if (exp->Operator == "==") {
                 emit(OpEq, vector<int>{});
             } else if (exp->Operator == "!=") {
@@ -173,7 +339,7 @@ class Compiler {
         }
         else if (type == ntypes.IntLiteral) {
             IntLiteral* lit = dynamic_cast<IntLiteral*>(node.get());
-            emit(OpConstant, vector<int>{addConstant(make_unique<Integer>(lit->value))});
+            emit(OpConstant, vector<int>{integerConstant(lit->value)});
         }
         else if (type == ntypes.BoolLiteral) {
             BoolLiteral* lit = dynamic_cast<BoolLiteral*>(node.get());
@@ -182,27 +348,11 @@ class Compiler {
         }
         else if (type == ntypes.IfExpression) {
             IfExpression* exp = dynamic_cast<IfExpression*>(node.get());
-            if (compile(move(exp->condition))) return 1; // failed to compile condition of if statement
-            int posJumpIfFalse = emit(OpJumpIfFalse, vector<int>{-1}); // fix later
-            if (compile(move(exp->consequence))) return 1; // failed to compile consequence
-            if (removeIfLastIs(OpPop)) return 1; // do not pop the result of consequence off stack
-
-            int posJump = emit(OpJump, vector<int>{-1});
-            changeOperand(posJumpIfFalse, vector<int>{(int) getCurrScope()->instructions.size()});
-
-            if (exp->alternative == nullptr) {
-                emit(OpNull, vector<int>{});
-            } else {
-                if (compile(move(exp->alternative))) return 1; // failed to compile alternative of if statement
-                if (removeIfLastIs(OpPop)) return 1;
-            }
-            changeOperand(posJump, vector<int>{(int) getCurrScope()->instructions.size()});
+            if (compileIfExpression(exp, false)) return 1;
         }
         else if (type == ntypes.BlockStatement) {
             BlockStatement* stmt = dynamic_cast<BlockStatement*>(node.get());
-            for (int i = 0; i < stmt->statements.size(); i++) {
-                if (compile(move(stmt->statements.at(i)))) return 1;
-            }
+            if (compileStatements(stmt->statements, true)) return 1;
         }
         else if (type == ntypes.StringLiteral) {
             StringLiteral* lit = dynamic_cast<StringLiteral*>(node.get());
@@ -232,18 +382,485 @@ class Compiler {
         return 0;
     }
 
+    /* Compile a list of statements. Every value but the last one's (or all of them
+    unless keepLast) is discarded, so if-expressions in those positions skip their
+    OpNull fallback. Statements after a return are never reached and not compiled. */
+    int compileStatements(vector<unique_ptr<Statement>>& statements, bool keepLast) {
+        for (int i = 0; i < statements.size(); i++) {
+            Statement* stmt = statements.at(i).get();
+            string type = stmt->getType();
+            bool discard = !keepLast || i < statements.size() - 1;
+            if (discard && type == ntypes.ExpressionStatement) {
+                ExpressionStatement* expStmt = dynamic_cast<ExpressionStatement*>(stmt);
+                if (expStmt->expression != nullptr && expStmt->expression->getType() == ntypes.IfExpression) {
+                    SourcePos outer = position;
+                    position = nodePosition(expStmt->expression.get());
+                    int err = compileIfExpression(dynamic_cast<IfExpression*>(expStmt->expression.get()), true);
+                    position = outer;
+                    if (err) return 1;
+                    continue;
+                }
+            }
+            if (compile(move(statements.at(i)))) return 1;
+            if (type == ntypes.ReturnStatement) break; // rest of the block is dead
+        }
+        return 0;
+    }
+
+    /* With discard set the if-expression leaves nothing on the stack: each arm
+    pops its own values and a missing alternative needs no OpNull */
+    int compileIfExpression(IfExpression* exp, bool discard) {
+        if (compile(move(exp->condition))) return 1; // failed to compile condition of if statement
+        int posJumpIfFalse = emit(OpJumpIfFalse, vector<int>{-1}); // fix later
+        if (discard) {
+            if (compileStatements(exp->consequence->statements, false)) return 1; // failed to compile consequence
+            if (exp->alternative == nullptr) return patchJump(posJumpIfFalse);
+        } else {
+            if (compile(move(exp->consequence))) return 1; // failed to compile consequence
+            if (removeIfLastIs(OpPop)) return 1; // do not pop the result of consequence off stack
+        }
+
+        int posJump = emit(OpJump, vector<int>{-1});
+        if (discard) {
+            if (compileStatements(exp->alternative->statements, false)) return 1; // failed to compile alternative of if statement
+        } else if (exp->alternative == nullptr) {
+            emit(OpNull, vector<int>{});
+        } else {
+            if (compile(move(exp->alternative))) return 1; // failed to compile alternative of if statement
+            if (removeIfLastIs(OpPop)) return 1;
+        }
+
+        // the false branch lands right behind the jump over the alternative, so
+        // widening either jump moves the other's target
+        auto& instructions = getCurrScope()->instructions;
+        int size = -1;
+        while (size != instructions.size()) {
+            size = instructions.size();
+            int len = instructionLength(instructions, posJumpIfFalse);
+            if (patchJumpTo(posJumpIfFalse, posJump + instructionLength(instructions, posJump))) return 1; // failed to patch jump
+            posJump += instructionLength(instructions, posJumpIfFalse) - len;
+            if (patchJump(posJump)) return 1;
+        }
+        return 0;
+    }
+
+    int compileFunctionBody(FnLiteral* fn, Instruction* instructions, vector<SourcePos>* positions) {
+        enterScope();
+        if (compile(move(fn->body))) return 1; // failed to compile func body
+        if (replaceIfLastIs(OpPop, OpRetVal)) return 1; // failed to replace pop instruction with return instruction
+        if (addIfLastIsNot(OpRetVal, OpRet)); // handle empty function
+        auto body = leaveScope(positions);
+        *instructions = optimize(body, positions, false);
+        return 0;
+    }
+
     int compileProgram(Program* program) {
-        for (int i = 0; i < program->statements.size(); i++) {
-            if (compile(move(program->statements.at(i)))) return 1;
+        map<string, vector<Expression*>> bindings;
+        for (auto& stmt : program->statements) collectBindings(stmt.get(), bindings);
+        for (auto& binding : bindings) bindingCounts[binding.first] += binding.second.size();
+        if (!options.incremental) inferGlobalTypes(bindings);
+
+        auto bodies = parallelFunctions(program, bindings);
+        // unoptimized bodies keep their in-place jump encoding, which relocation would change
+        bool parallel = options.compileThreads > 1 && bodies.size() > 1 && options.optimizationLevel >= 1;
+        if (!parallel) return compileStatements(program->statements, true);
+        vector<promise<FunctionFragment>> fragments(bodies.size());
+        for (int i = 0; i < bodies.size(); i++) pendingFunctions[bodies.at(i)] = fragments.at(i).get_future();
+        atomic<int> next(0);
+        vector<thread> workers;
+        for (int t = 0; t < min(options.compileThreads, (int) bodies.size()); t++) {
+            workers.emplace_back([&]() {
+                for (int i = next++; i < bodies.size(); i = next++) fragments.at(i).set_value(compileFragment(bodies.at(i)));
+            });
+        }
+        int err = compileStatements(program->statements, true);
+        next = bodies.size(); // stop handing out bodies if compilation failed early
+        for (auto& worker : workers) worker.join();
+        pendingFunctions.clear();
+        return err;
+    }
+
+    /* Call visit on node and everything below it; visit returns false to skip the
+    children of a node */
+    void visitNodes(Node* node, const function<bool(Node*)>& visit) {
+        if (node == nullptr || !visit(node)) return;
+        string type = node->getType();
+        if (type == ntypes.LetStatement) {
+            visitNodes(dynamic_cast<LetStatement*>(node)->value.get(), visit);
+        } else if (type == ntypes.ReturnStatement) {
+            visitNodes(dynamic_cast<ReturnStatement*>(node)->value.get(), visit);
+        } else if (type == ntypes.WhileStatement) {
+            WhileStatement* stmt = dynamic_cast<WhileStatement*>(node);
+            visitNodes(stmt->condition.get(), visit);
+            visitNodes(stmt->body.get(), visit);
+        } else if (type == ntypes.ExpressionStatement) {
+            visitNodes(dynamic_cast<ExpressionStatement*>(node)->expression.get(), visit);
+        } else if (type == ntypes.BlockStatement) {
+            for (auto& stmt : dynamic_cast<BlockStatement*>(node)->statements) visitNodes(stmt.get(), visit);
+        } else if (type == ntypes.FnLiteral) {
+            visitNodes(dynamic_cast<FnLiteral*>(node)->body.get(), visit);
+        } else if (type == ntypes.CallExpression) {
+            CallExpression* exp = dynamic_cast<CallExpression*>(node);
+            visitNodes(exp->function.get(), visit);
+            for (auto& arg : exp->args) visitNodes(arg.get(), visit);
+        } else if (type == ntypes.IfExpression) {
+            IfExpression* exp = dynamic_cast<IfExpression*>(node);
+            visitNodes(exp->condition.get(), visit);
+            visitNodes(exp->consequence.get(), visit);
+            visitNodes(exp->alternative.get(), visit);
+        } else if (type == ntypes.PrefixExpression) {
+            visitNodes(dynamic_cast<PrefixExpression*>(node)->right.get(), visit);
+        } else if (type == ntypes.InfixExpression) {
+            InfixExpression* exp = dynamic_cast<InfixExpression*>(node);
+            visitNodes(exp->left.get(), visit);
+            visitNodes(exp->right.get(), visit);
+        } else if (type == ntypes.ArrayLiteral) {
+            for (auto& element : dynamic_cast<ArrayLiteral*>(node)->elements) visitNodes(element.get(), visit);
+        } else if (type == ntypes.HashLiteral) {
+            for (auto& pair : dynamic_cast<HashLiteral*>(node)->pairs) {
+                visitNodes(pair.first.get(), visit);
+                visitNodes(pair.second.get(), visit);
+            }
+        } else if (type == ntypes.IndexExpression) {
+            IndexExpression* exp = dynamic_cast<IndexExpression*>(node);
+            visitNodes(exp->entity.get(), visit);
+            visitNodes(exp->index.get(), visit);
+        }
+    }
+
+    /* Collect every value bound to each name by a let statement across the whole
+    program, including function bodies */
+    void collectBindings(Node* node, map<string, vector<Expression*>>& bindings) {
+        visitNodes(node, [&](Node* n) {
+            if (n->getType() == ntypes.LetStatement) {
+                LetStatement* stmt = dynamic_cast<LetStatement*>(n);
+                bindings[stmt->identifier.value].push_back(stmt->value.get());
+            }
+            return true;
+        });
+    }
+
+    int bindingCount(string name) {
+        auto it = bindingCounts.find(name);
+        return it == bindingCounts.end() ? 0 : it->second;
+    }
+
+    /******************** type inference *******************/
+    /* Flow-insensitive: a global's type is the join of the types of every value ever
+    bound to it. Starts optimistic ("" = no value seen yet) and iterates to a fixpoint. */
+    void inferGlobalTypes(map<string, vector<Expression*>>& bindings) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto& binding : bindings) {
+                string type = globalTypes[binding.first];
+                for (Expression* value : binding.second) type = joinTypes(type, inferType(value));
+                if (type != globalTypes[binding.first]) {
+                    globalTypes[binding.first] = type;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    string joinTypes(string a, string b) {
+        if (a == "") return b;
+        if (b == "" || a == b) return a;
+        return anyType;
+    }
+
+    /* Static type of an expression: an object type name, "" if it depends on globals
+    with no known value yet, or anyType */
+    string inferType(Expression* exp) {
+        if (exp == nullptr) return anyType;
+        string type = exp->getType();
+        if (type == ntypes.IntLiteral) return objs.INTEGER_OBJ;
+        if (type == ntypes.StringLiteral) return objs.STRING_OBJ;
+        if (type == ntypes.BoolLiteral) return objs.BOOLEAN_OBJ;
+        if (type == ntypes.Identifier) {
+            Identifier* ident = dynamic_cast<Identifier*>(exp);
+            return globalTypes.count(ident->value) ? globalTypes.at(ident->value) : anyType;
+        }
+        if (type == ntypes.PrefixExpression) {
+            PrefixExpression* prefix = dynamic_cast<PrefixExpression*>(exp);
+            if (prefix->Operator == "!") return objs.BOOLEAN_OBJ;
+            string right = inferType(prefix->right.get());
+            return right == "" || right == objs.INTEGER_OBJ ? right : anyType;
+        }
+        if (type == ntypes.InfixExpression) {
+            InfixExpression* infix = dynamic_cast<InfixExpression*>(exp);
+            string op = infix->Operator;
+            if (op == "==" || op == "!=" || op == "<" || op == ">") return objs.BOOLEAN_OBJ;
+            string left = inferType(infix->left.get());
+            string right = inferType(infix->right.get());
+            if (left == "" || right == "") return "";
+            if (left == objs.INTEGER_OBJ && right == objs.INTEGER_OBJ) return objs.INTEGER_OBJ;
+            if (op == "+" && left == objs.STRING_OBJ && right == objs.STRING_OBJ) return objs.STRING_OBJ;
+            return anyType;
+        }
+        return anyType;
+    }
+
+    /******************** inlining *******************/
+    /* Whether the code of constIdx calls the global target, directly or through
+    other known functions */
+    bool reachesCall(int constIdx, int target, set<int>& visited) {
+        if (!visited.insert(constIdx).second) return false;
+        CompiledFunction* fn = dynamic_cast<CompiledFunction*>(constants.at(constIdx).get());
+        auto code = decodeInstructions(fn->instructions);
+        for (int i = 0; i + 1 < code.size(); i++) {
+            if (code.at(i).opcode != OpGetGlobal || code.at(i + 1).opcode != OpCall) continue;
+            int callee = code.at(i).operands.at(0);
+            if (callee == target) return true;
+            if (knownFunctions.count(callee) && reachesCall(knownFunctions[callee], target, visited)) return true;
+        }
+        return false;
+    }
+
+    /* Constant index of the function to inline for a call to name, or -1 */
+    int inlineCandidate(string name) {
+        if (options.optimizationLevel < 1 || bindingCount(name) == 0) return -1; // not bound by this program
+        int index = symbolTable.resolve(name) == nullptr ? -1 : symbolTable.resolve(name).get()->index;
+        if (index < 0 || knownFunctions.count(index) == 0) {
+            if (bindingCount(name) > 1) inlineDecisions.push_back(InlineDecision{name, false, "bound more than once"});
+            return -1;
+        }
+        int constIdx = knownFunctions[index];
+        CompiledFunction* fn = dynamic_cast<CompiledFunction*>(constants.at(constIdx).get());
+        int size = fn->instructions.size();
+        set<int> visited;
+        if (reachesCall(constIdx, index, visited)) {
+            inlineDecisions.push_back(InlineDecision{name, false, "recursive"});
+            return -1;
+        }
+        if (size > options.inlineBudget) {
+            inlineDecisions.push_back(InlineDecision{name, false, to_string(size) + " bytes over budget of " + to_string(options.inlineBudget)});
+            return -1;
+        }
+        // a return with operands of the callee still pushed would leave them on the caller's stack
+        int depth = 0;
+        if (stackDepth(fn->instructions.data(), size, true, &depth)) {
+            inlineDecisions.push_back(InlineDecision{name, false, "unbalanced stack"});
+            return -1;
+        }
+        inlineDecisions.push_back(InlineDecision{name, true, to_string(size) + " bytes"});
+        return constIdx;
+    }
+
+    /* Inlined instructions keep the positions of the callee's source */
+    void emitInlined(int constIdx) {
+        CompiledFunction* fn = dynamic_cast<CompiledFunction*>(constants.at(constIdx).get());
+        auto positions = expandPositions(fn->positions, fn->instructions.size());
+        auto body = inlineBody(fn->instructions, &positions);
+        int pos = addInstruction(body, positions);
+        // record the last instruction of the inlined body
+        DecodedInstruction last{};
+        for (auto& ins : InstructionRange(body)) last = ins;
+        setLastInstruction(last.opcode, pos + last.offset);
+    }
+
+    string inlineReport() {
+        ostringstream buffer;
+        for (auto& decision : inlineDecisions) {
+            buffer << decision.callee << ": " << (decision.inlined ? "inlined" : "not inlined")
+                   << " (" << decision.reason << ")" << endl;
+        }
+        return buffer.str();
+    }
+
+    /******************** parallel compilation *******************/
+    /* Function literals bound by top-level let statements whose bodies can be
+    compiled without the state of the rest of the program. A body that calls a
+    global bound once to a fn literal may inline it, so it has to wait its turn. */
+    vector<FnLiteral*> parallelFunctions(Program* program, map<string, vector<Expression*>>& bindings) {
+        vector<FnLiteral*> res;
+        for (auto& stmt : program->statements) {
+            if (stmt->getType() != ntypes.LetStatement) continue;
+            Expression* value = dynamic_cast<LetStatement*>(stmt.get())->value.get();
+            if (value == nullptr || value->getType() != ntypes.FnLiteral) continue;
+            bool independent = true;
+            visitNodes(value, [&](Node* n) {
+                if (n->getType() != ntypes.CallExpression) return independent;
+                Expression* callee = dynamic_cast<CallExpression*>(n)->function.get();
+                if (callee == nullptr || callee->getType() != ntypes.Identifier) return independent;
+                auto& values = bindings[dynamic_cast<Identifier*>(callee)->value];
+                if (values.size() == 1 && values.at(0) != nullptr && values.at(0)->getType() == ntypes.FnLiteral) independent = false;
+                return independent;
+            });
+            if (independent) res.push_back(dynamic_cast<FnLiteral*>(value));
+        }
+        return res;
+    }
+
+    int fragmentGlobal(string name, bool define, int fnConst) {
+        if (globalNameIds.count(name) == 0) {
+            globalNameIds[name] = globalNames.size();
+            globalNames.push_back(name);
+        }
+        globalRefs.push_back(GlobalRef{globalNameIds.at(name), define, fnConst});
+        return globalNameIds.at(name);
+    }
+
+    /* Runs on a worker thread; only reads the inference results of this compiler */
+    FunctionFragment compileFragment(FnLiteral* fn) {
+        Compiler worker(options);
+        worker.fragment = true;
+        worker.bindingCounts = bindingCounts;
+        worker.globalTypes = globalTypes;
+        Instruction instructions;
+        vector<SourcePos> positions;
+        int err = worker.compileFunctionBody(fn, &instructions, &positions);
+        return FunctionFragment{err, instructions, positions, move(worker.constants), move(worker.globalNames), move(worker.globalRefs), move(worker.inlineDecisions)};
+    }
+
+    /* Rewrite fragment operands to program constant and global indices. Re-encoding
+    gives the same bytes the body would have compiled to in place. */
+    Instruction relocate(const Instruction& instructions, const vector<int>& consts, const vector<int>& globals, vector<SourcePos>* positions) {
+        auto code = decodeInstructions(instructions, positions);
+        for (auto& ins : code) {
+            if (ins.opcode == OpConstant) ins.operands.at(0) = consts.at(ins.operands.at(0));
+            else if (ins.opcode == OpGetGlobal || ins.opcode == OpSetGlobal) ins.operands.at(0) = globals.at(ins.operands.at(0));
+        }
+        return encodeInstructions(code, positions);
+    }
+
+    /* Add a fragment to the program at the point its fn literal is compiled, replaying
+    its global references in order so symbols get the indices they would have had.
+    Its small integers join the shared constants, the rest are appended in order. */
+    int spliceFragment(FunctionFragment fragment, Instruction* instructions, vector<SourcePos>* positions) {
+        if (fragment.err) return 1;
+        vector<int> consts;
+        vector<CompiledFunction*> fns;
+        for (auto& obj : fragment.constants) {
+            Integer* integer = dynamic_cast<Integer*>(obj.get());
+            CompiledFunction* fn = dynamic_cast<CompiledFunction*>(obj.get());
+            if (fn != nullptr) fns.push_back(fn);
+            consts.push_back(integer != nullptr ? integerConstant(integer->value) : addConstant(move(obj)));
+        }
+        vector<int> globals(fragment.globalNames.size(), -1);
+        for (auto& ref : fragment.globalRefs) {
+            string name = fragment.globalNames.at(ref.name);
+            if (ref.define) {
+                int index = defineGlobal(name);
+                if (ref.fnConst >= 0) knownFunctions[index] = consts.at(ref.fnConst);
+                globals.at(ref.name) = index;
+            } else {
+                if (symbolTable.resolve(name) == nullptr) return 1; // global used before it is defined
+                globals.at(ref.name) = symbolTable.resolve(name).get()->index;
+            }
+        }
+        for (auto fn : fns) {
+            auto fnPositions = expandPositions(fn->positions, fn->instructions.size());
+            fn->instructions = relocate(fn->instructions, consts, globals, &fnPositions);
+            fn->positions = encodePositions(fn->instructions, fnPositions);
         }
+        inlineDecisions.insert(inlineDecisions.end(), fragment.inlineDecisions.begin(), fragment.inlineDecisions.end());
+        *positions = fragment.positions;
+        *instructions = relocate(fragment.instructions, consts, globals, positions);
         return 0;
     }
 
+    /******************** optimization levels *******************/
+    /* positions holds one entry per byte and is updated to match the result */
+    Instruction optimize(const Instruction& instructions, vector<SourcePos>* positions, bool main) {
+        if (options.optimizationLevel < 1) return instructions;
+        auto res = eliminateDeadCode(instructions, positions);
+        if (options.optimizationLevel < 2) return res;
+        SsaTemps temps = {
+            [this](int k) {
+                string name = "%t" + to_string(k); // cannot clash with an identifier
+                return fragment ? fragmentGlobal(name, true, -1) : defineGlobal(name);
+            },
+            [this](int operand) {
+                if (fragment) return tempNumber(globalNames.at(operand));
+                return tempGlobals.count(operand) ? tempGlobals.at(operand) : -1;
+            }
+        };
+        return optimizeSsa(res, main, temps, positions);
+    }
+
+    int tempNumber(string name) {
+        return name.rfind("%t", 0) == 0 ? stoi(name.substr(2)) : -1;
+    }
+
+    int defineGlobal(string name) {
+        int index = symbolTable.define(name).get()->index;
+        if (tempNumber(name) >= 0) tempGlobals[index] = tempNumber(name);
+        return index;
+    }
+
+    SymbolTable& getSymbolTable() {
+        return symbolTable;
+    }
+
     ByteCode getByteCode() {
-        ByteCode bc = {getCurrScope()->instructions, move(constants)};
+        auto positions = getCurrScope()->positions;
+        auto instructions = optimize(getCurrScope()->instructions, &positions, true);
+        ByteCode bc = {instructions, move(constants), encodePositions(instructions, positions), frameSize(instructions, false)};
+        fill(smallIntegers.begin(), smallIntegers.end(), -1); // the constants they index are gone
+        return bc;
+    }
+
+    /* Bytecode of everything compiled since the last call, for a VM that already
+    holds the earlier constants. The main scope starts over for the next program. */
+    ByteCode takeByteCode() {
+        ByteCode bc;
+        auto positions = scopes.at(0).get()->positions;
+        bc.instructions = optimize(scopes.at(0).get()->instructions, &positions, true);
+        bc.positions = encodePositions(bc.instructions, positions);
+        bc.maxStack = frameSize(bc.instructions, false);
+        for (int i = emittedConstants; i < constants.size(); i++) bc.constants.push_back(copyConstant(constants.at(i).get()));
+        emittedConstants = constants.size();
+        emittedGlobals = GlobalsCheckpoint{map<string, int>{}, symbolTable.numDefs, bindingCounts, knownFunctions, globalTypes};
+        for (auto& entry : symbolTable.store) {
+            if (entry.second != nullptr) emittedGlobals.symbols[entry.first] = entry.second->index;
+        }
+        resetMainScope();
         return bc;
     }
 
+    /* Forget a program that failed to compile. Its constants never reach the VM and
+    its globals are never set, so the next program must not refer to either. */
+    void dropByteCode() {
+        constants.resize(emittedConstants);
+        for (int& index : smallIntegers) {
+            if (index >= emittedConstants) index = -1;
+        }
+        symbolTable.store.clear();
+        for (auto& symbol : emittedGlobals.symbols) symbolTable.store[symbol.first] = make_unique<Symbol>(symbol.first, GlobalScope, symbol.second);
+        symbolTable.numDefs = emittedGlobals.numDefs;
+        bindingCounts = emittedGlobals.bindingCounts;
+        knownFunctions = emittedGlobals.knownFunctions;
+        globalTypes = emittedGlobals.globalTypes;
+        resetMainScope();
+    }
+
+    void resetMainScope() {
+        scopes.resize(1);
+        scopes.at(0) = make_unique<CompilationScope>(CompilationScope{Instruction{}, EmittedInstruction{}, EmittedInstruction{}});
+        scopeIndex = 0;
+    }
+
+    /* Operand stack a frame running the code needs, -1 if it cannot be determined */
+    int frameSize(const Instruction& instructions, bool function) {
+        int depth = 0;
+        return stackDepth(instructions.data(), instructions.size(), function, &depth) ? -1 : depth;
+    }
+
+    unique_ptr<Object> copyConstant(Object* obj) {
+        if (obj->kind == IntegerObject) return make_unique<Integer>(*static_cast<Integer*>(obj));
+        if (obj->kind == StringObject) return make_unique<String>(*static_cast<String*>(obj));
+        return make_unique<CompiledFunction>(*static_cast<CompiledFunction*>(obj));
+    }
+
+    /* Every literal of a small integer shares one constant, and so one value in the VM */
+    int integerConstant(int value) {
+        if (value < smallIntegerMin || value > smallIntegerMax) return addConstant(make_unique<Integer>(value));
+        int& index = smallIntegers.at(value - smallIntegerMin);
+        if (index < 0) index = addConstant(make_unique<Integer>(value));
+        return index;
+    }
+
     int addConstant(unique_ptr<Object> obj) {
         constants.push_back(move(obj));
         return constants.size() - 1; // return index of obj in the constant list as the unique id
@@ -252,18 +869,20 @@ class Compiler {
     int emit(OpCode opcode, vector<int> operands) {
         auto instruction = constructByteCode(opcode, operands);
         // cout << serialize(instruction) << endl;
-        int pos = addInstruction(instruction);
+        int pos = addInstruction(instruction, vector<SourcePos>(instruction.size(), position));
         auto scope = getCurrScope();
         scope->prevLast = scope->last;
         scope->last = EmittedInstruction{opcode, pos};
         return pos;
     }
 
-    int addInstruction(Instruction instruction) {
+    int addInstruction(Instruction instruction, const vector<SourcePos>& positions) {
         Instruction temp = getCurrInstructions();
         int pos = temp.size();
         temp.insert(temp.end(), instruction.begin(), instruction.end());
         scopes.at(scopeIndex).get()->instructions = temp; // suspect
+        auto& scopePositions = getCurrScope()->positions;
+        scopePositions.insert(scopePositions.end(), positions.begin(), positions.end());
         return pos;
     }
 
@@ -277,8 +896,9 @@ class Compiler {
         scopeIndex++;
     }
 
-    Instruction leaveScope() {
+    Instruction leaveScope(vector<SourcePos>* positions = nullptr) {
         auto instructions = getCurrInstructions();
+        if (positions != nullptr) *positions = getCurrScope()->positions;
         scopes.pop_back();
         scopeIndex--;
         return instructions;
@@ -0,0 +1,251 @@
+#include"slab.cpp"
+#include<chrono>
+#include<deque>
+#include<new>
+#include<sstream>
+#include<vector>
+
+using namespace std;
+
+/******************** garbage collected heap *******************/
+/* Owns every object the VM creates or loads. Collection is a precise mark and
+sweep: marking starts from the roots and follows the references of every object
+reached, and whatever is left unmarked is freed. A collection is due once the
+heap has grown to threshold bytes; afterwards the threshold is set to the live
+bytes times growthFactor, and never below minThreshold. Objects the VM makes come
+from the heap's slab allocator, unless useSlabs is off; loaded constants keep the
+allocation they were compiled into.
+
+Incremental mode spreads a collection over slices of at most maxPauseMs, one
+every sliceBytes allocated, using the tri-color scheme: unmarked objects are
+white, marked ones waiting on the gray list are gray, traced ones black. The
+first slice marks the stack; globals and constants are scanned by later slices
+like gray objects. What is marked is what was reachable when the cycle began,
+which holds because:
+- objects are never written once built, and the ones allocated during marking
+  start black;
+- overwriting a global goes through the overwrite barrier, which marks the old
+  value before it is lost, in case its slot was not scanned yet. */
+struct HeapStats {
+    long long collections = 0;
+    long long pauses = 0; // whole collections and incremental slices
+    double totalPauseMs = 0;
+    double maxPauseMs = 0;
+    vector<long long> pauseHistogram = vector<long long>(21); // bucket i counts pauses under 2^i us, the last one all longer
+    size_t bytesFreed = 0; // over all collections
+    size_t liveBytes = 0; // after the last collection
+    size_t liveObjects = 0;
+};
+
+/* What the VM can still read: the stack up to and including top, globals and constants */
+struct HeapRoots {
+    const vector<Value>* stack;
+    int top;
+    const vector<Value>* globals;
+    const deque<Value>* constants;
+};
+
+enum GcPhase {
+    GcIdle,
+    GcMarking,
+    GcSweeping
+};
+
+class Heap {
+    typedef chrono::steady_clock Clock;
+
+    public:
+    Object* objects = nullptr; // most recently allocated first
+    size_t bytes = 0; // charged to objects not yet freed
+    size_t minThreshold = 1 << 20;
+    size_t threshold = 1 << 20;
+    double growthFactor = 2;
+    bool useSlabs = true;
+    SlabAllocator slabs;
+    bool incremental = false;
+    double maxPauseMs = 1;
+    size_t sliceBytes = 64 << 10;
+    HeapStats stats;
+
+    GcPhase phase = GcIdle;
+    vector<Object*> gray;
+    size_t globalsScanned = 0; // roots marked so far in this cycle
+    size_t constantsScanned = 0;
+    Object** sweepLink = nullptr; // link to the next object to sweep
+    size_t nextSlice = 0;
+
+    Heap() = default;
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+    ~Heap() {
+        while (objects != nullptr) {
+            Object* next = objects->next;
+            if (objects->blockSize > 0 && SlabAllocator::sizeClass(objects->blockSize) < slabClasses) {
+                objects->~Object(); // the slabs go all at once
+            } else {
+                release(objects);
+            }
+            objects = next;
+        }
+    }
+
+    template<typename T, typename... Args> Value allocate(Args&&... args) {
+        static_assert(sizeof(T) <= UINT16_MAX, "block sizes are kept in 16 bits");
+        if (!useSlabs) return adopt(new T(forward<Args>(args)...));
+        T* obj = new (slabs.allocate(sizeof(T))) T(forward<Args>(args)...);
+        obj->blockSize = sizeof(T);
+        return adopt(obj);
+    }
+
+    void release(Object* obj) {
+        size_t size = obj->blockSize;
+        if (size == 0) {
+            delete obj;
+            return;
+        }
+        obj->~Object();
+        slabs.deallocate(obj, size);
+    }
+
+    Value adopt(Object* obj) {
+        obj->heapSize = obj->footprint();
+        obj->marked = phase == GcMarking; // black
+        obj->next = objects;
+        objects = obj;
+        if (sweepLink == &objects) sweepLink = &obj->next; // white, but not swept in this cycle
+        bytes += obj->heapSize;
+        Value value(ObjectValue);
+        value.object = obj;
+        return value;
+    }
+
+    /* The value of a constant: the scalars move inline, other objects join the heap */
+    Value constant(unique_ptr<Object> obj) {
+        if (obj->kind == IntegerObject) return integerValue(static_cast<Integer*>(obj.get())->value);
+        if (obj->kind == BooleanObject) return booleanValue(static_cast<Boolean*>(obj.get())->value);
+        if (obj->kind == NullObject) return nullValue();
+        return adopt(obj.release());
+    }
+
+    bool collectionDue() const {
+        return phase == GcIdle ? bytes >= threshold : bytes >= nextSlice;
+    }
+
+    /* Write barrier, called with a global about to be overwritten */
+    void overwrite(const Value& old) {
+        if (phase == GcMarking) markValue(old, &gray);
+    }
+
+    /* Stop the world and collect, finishing the incremental cycle if one is running */
+    void collect(const HeapRoots& roots) {
+        auto start = Clock::now();
+        if (phase == GcIdle) startCycle(roots);
+        if (phase == GcMarking) {
+            markSome(roots, Clock::time_point::max());
+            startSweep();
+        }
+        sweepSome(Clock::time_point::max());
+        finishCycle();
+        recordPause(start);
+    }
+
+    /* One incremental slice */
+    void step(const HeapRoots& roots) {
+        auto start = Clock::now();
+        auto deadline = start + chrono::duration_cast<Clock::duration>(chrono::duration<double, milli>(maxPauseMs));
+        if (phase == GcIdle) {
+            startCycle(roots);
+        } else if (phase == GcMarking) {
+            if (markSome(roots, deadline)) startSweep();
+        } else if (sweepSome(deadline)) {
+            finishCycle();
+        }
+        nextSlice = bytes + sliceBytes;
+        recordPause(start);
+    }
+
+    void startCycle(const HeapRoots& roots) {
+        phase = GcMarking;
+        for (int i = 0; i <= roots.top && i < roots.stack->size(); i++) markValue(roots.stack->at(i), &gray);
+        globalsScanned = 0;
+        constantsScanned = 0;
+    }
+
+    /* Returns whether marking is done, having run past deadline otherwise */
+    bool markSome(const HeapRoots& roots, Clock::time_point deadline) {
+        for (int n = 1; ; n++) {
+            if (!gray.empty()) {
+                Object* obj = gray.back();
+                gray.pop_back();
+                obj->trace(&gray);
+            } else if (globalsScanned < roots.globals->size()) {
+                markValue(roots.globals->at(globalsScanned++), &gray);
+            } else if (constantsScanned < roots.constants->size()) {
+                markValue(roots.constants->at(constantsScanned++), &gray);
+            } else {
+                return true;
+            }
+            if (n % 32 == 0 && Clock::now() >= deadline) return false;
+        }
+    }
+
+    void startSweep() {
+        phase = GcSweeping;
+        sweepLink = &objects;
+        stats.liveObjects = 0;
+    }
+
+    /* Returns whether sweeping is done, having run past deadline otherwise */
+    bool sweepSome(Clock::time_point deadline) {
+        for (int n = 1; *sweepLink != nullptr; n++) {
+            Object* obj = *sweepLink;
+            if (obj->marked) {
+                obj->marked = false;
+                stats.liveObjects++;
+                sweepLink = &obj->next;
+            } else {
+                *sweepLink = obj->next;
+                bytes -= obj->heapSize;
+                stats.bytesFreed += obj->heapSize;
+                release(obj);
+            }
+            if (n % 32 == 0 && Clock::now() >= deadline) return false;
+        }
+        return true;
+    }
+
+    void finishCycle() {
+        phase = GcIdle;
+        sweepLink = nullptr;
+        stats.collections++;
+        stats.liveBytes = bytes;
+        threshold = max(minThreshold, (size_t) (bytes * growthFactor));
+    }
+
+    void recordPause(Clock::time_point start) {
+        double ms = chrono::duration<double, milli>(Clock::now() - start).count();
+        stats.pauses++;
+        stats.totalPauseMs += ms;
+        stats.maxPauseMs = max(stats.maxPauseMs, ms);
+        int bucket = 0;
+        for (double us = ms * 1000; us >= 1 && bucket < stats.pauseHistogram.size() - 1; us /= 2) bucket++;
+        stats.pauseHistogram.at(bucket)++;
+    }
+
+    string report() const {
+        stringstream out;
+        out << "collections: " << stats.collections << " in " << stats.pauses << " pauses"
+            << ", pause total/max: " << stats.totalPauseMs << "/" << stats.maxPauseMs << " ms"
+            << ", freed: " << stats.bytesFreed << " bytes"
+            << ", live: " << stats.liveBytes << " bytes in " << stats.liveObjects << " objects"
+            << ", heap: " << bytes << " bytes\n";
+        out << "pauses:";
+        for (int i = 0; i < stats.pauseHistogram.size(); i++) {
+            if (stats.pauseHistogram.at(i) == 0) continue;
+            if (i == stats.pauseHistogram.size() - 1) out << " >=" << (1 << (i - 1)) << "us: ";
+            else out << " <" << (1 << i) << "us: ";
+            out << stats.pauseHistogram.at(i);
+        }
+        return out.str();
+    }
+};
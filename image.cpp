@@ -0,0 +1,246 @@
+#include"compiler.cpp"
+#include<cstring>
+#include<fstream>
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<unistd.h>
+
+using namespace std;
+
+/******************** precompiled bytecode image *******************/
+/* Layout, all integers in host byte order:
+    ImageHeader
+    ImageConstant[numConstants]
+    ImageSymbol[numSymbols]
+    data section: instructions and position tables of the main program and of every function, string bytes
+Every record is fixed size and refers into the data section by offset, so loading
+is bounds checks plus one copy per constant, with no parsing or decoding. */
+const char imageMagic[4] = {'S', 'A', 'P', 'L'};
+const uint32_t imageVersion = 3; // bump whenever the opcode set or the layout changes
+
+enum ImageConstantKind : uint32_t {
+    ImageInteger = 0,
+    ImageString = 1,
+    ImageFunction = 2
+};
+
+struct ImageHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t mainOffset; // main program instructions, relative to the data section
+    uint32_t mainLength;
+    uint32_t mainPositionsOffset;
+    uint32_t mainPositionsLength;
+    int32_t mainMaxStack; // -1 if unknown
+    uint32_t numConstants;
+    uint32_t numSymbols;
+    uint32_t dataOffset; // data section, relative to the start of the file
+    uint32_t dataLength;
+};
+
+struct ImageConstant {
+    uint32_t kind;
+    int32_t value; // integers
+    uint32_t offset; // strings and functions, relative to the data section
+    uint32_t length;
+    uint32_t positionsOffset; // functions
+    uint32_t positionsLength;
+    int32_t maxStack;
+};
+
+struct ImageSymbol {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t index;
+};
+
+uint32_t appendData(vector<byte>& data, const void* src, size_t length) {
+    uint32_t offset = data.size();
+    data.resize(data.size() + length);
+    if (length > 0) memcpy(data.data() + offset, src, length);
+    return offset;
+}
+
+int writeImage(string path, ByteCode& bytecode, SymbolTable& symbols) {
+    vector<byte> data;
+    ImageHeader header;
+    memcpy(header.magic, imageMagic, sizeof(imageMagic));
+    header.version = imageVersion;
+    header.mainLength = bytecode.instructions.size();
+    header.mainOffset = appendData(data, bytecode.instructions.data(), header.mainLength);
+    header.mainPositionsLength = bytecode.positions.size();
+    header.mainPositionsOffset = appendData(data, bytecode.positions.data(), header.mainPositionsLength);
+    header.mainMaxStack = bytecode.maxStack;
+
+    vector<ImageConstant> constants;
+    for (auto& obj : bytecode.constants) {
+        ImageConstant constant = {ImageInteger, 0, 0, 0, 0, 0, -1};
+        if (obj->kind == IntegerObject) {
+            constant.value = static_cast<Integer*>(obj.get())->value;
+        } else if (obj->kind == StringObject) {
+            String* str = static_cast<String*>(obj.get());
+            constant.kind = ImageString;
+            constant.length = str->value.size();
+            constant.offset = appendData(data, str->value.data(), constant.length);
+        } else if (obj->kind == CompiledFunctionObject) {
+            CompiledFunction* fn = static_cast<CompiledFunction*>(obj.get());
+            constant.kind = ImageFunction;
+            constant.length = fn->instructions.size();
+            constant.offset = appendData(data, fn->instructions.data(), constant.length);
+            constant.positionsLength = fn->positions.size();
+            constant.positionsOffset = appendData(data, fn->positions.data(), constant.positionsLength);
+            constant.maxStack = fn->maxStack;
+        } else {
+            return 1; // constant type cannot be stored
+        }
+        constants.push_back(constant);
+    }
+
+    vector<ImageSymbol> imageSymbols;
+    for (auto& entry : symbols.store) {
+        if (entry.second == nullptr) continue; // resolved but never defined
+        ImageSymbol symbol;
+        symbol.nameLength = entry.first.size();
+        symbol.nameOffset = appendData(data, entry.first.data(), symbol.nameLength);
+        symbol.index = entry.second.get()->index;
+        imageSymbols.push_back(symbol);
+    }
+
+    header.numConstants = constants.size();
+    header.numSymbols = imageSymbols.size();
+    header.dataOffset = sizeof(ImageHeader) + sizeof(ImageConstant) * constants.size() + sizeof(ImageSymbol) * imageSymbols.size();
+    header.dataLength = data.size();
+
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) return 1; // cannot open file
+    out.write((const char*) &header, sizeof(header));
+    out.write((const char*) constants.data(), sizeof(ImageConstant) * constants.size());
+    out.write((const char*) imageSymbols.data(), sizeof(ImageSymbol) * imageSymbols.size());
+    out.write((const char*) data.data(), data.size());
+    return out ? 0 : 1;
+}
+
+/* Read-only mapping of an image file, unmapped when it goes out of scope */
+class MappedImage {
+    public:
+    const byte* base = nullptr;
+    size_t size = 0;
+
+    MappedImage(string path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                base = (const byte*) addr;
+                size = st.st_size;
+            }
+        }
+        close(fd);
+    }
+    ~MappedImage() {
+        if (base != nullptr) munmap((void*) base, size);
+    }
+    MappedImage(const MappedImage&) = delete;
+    MappedImage& operator=(const MappedImage&) = delete;
+};
+
+bool inData(const ImageHeader* header, uint32_t offset, uint32_t length) {
+    return offset <= header->dataLength && length <= header->dataLength - offset;
+}
+
+/* The header of a mapped image whose tables and data fit the file, nullptr if it
+is not an image of this version */
+const ImageHeader* validateImage(const MappedImage& image) {
+    if (image.base == nullptr || image.size < sizeof(ImageHeader)) return nullptr; // cannot map image
+    const ImageHeader* header = (const ImageHeader*) image.base;
+    if (memcmp(header->magic, imageMagic, sizeof(imageMagic)) != 0) return nullptr; // not an image
+    if (header->version != imageVersion) return nullptr; // compiled for another opcode set or layout
+    size_t tables = sizeof(ImageHeader) + sizeof(ImageConstant) * (size_t) header->numConstants + sizeof(ImageSymbol) * (size_t) header->numSymbols;
+    if (header->dataOffset != tables || (size_t) header->dataOffset + header->dataLength > image.size) return nullptr; // truncated image
+    return header;
+}
+
+/* The tables and data following a validated header */
+const ImageConstant* imageConstants(const ImageHeader* header) {
+    return (const ImageConstant*) (header + 1);
+}
+
+const ImageSymbol* imageSymbols(const ImageHeader* header) {
+    return (const ImageSymbol*) (imageConstants(header) + header->numConstants);
+}
+
+const byte* imageData(const ImageHeader* header) {
+    return (const byte*) header + header->dataOffset;
+}
+
+int loadImage(string path, ByteCode* bytecode, SymbolTable* symbols) {
+    MappedImage image(path);
+    const ImageHeader* header = validateImage(image);
+    if (header == nullptr) return 1; // not a valid image
+    const ImageConstant* constants = imageConstants(header);
+    const ImageSymbol* symbolTable = imageSymbols(header);
+    const byte* data = imageData(header);
+
+    if (!inData(header, header->mainOffset, header->mainLength)) return 1;
+    if (!inData(header, header->mainPositionsOffset, header->mainPositionsLength)) return 1;
+    bytecode->instructions = Instruction(data + header->mainOffset, data + header->mainOffset + header->mainLength);
+    const byte* mainPositions = data + header->mainPositionsOffset;
+    bytecode->positions = PositionTable(mainPositions, mainPositions + header->mainPositionsLength);
+    bytecode->maxStack = header->mainMaxStack;
+    bytecode->constants.clear();
+    bytecode->constants.reserve(header->numConstants);
+    for (uint32_t i = 0; i < header->numConstants; i++) {
+        const ImageConstant& constant = constants[i];
+        if (constant.kind == ImageInteger) {
+            bytecode->constants.push_back(make_unique<Integer>(constant.value));
+            continue;
+        }
+        if (!inData(header, constant.offset, constant.length)) return 1;
+        const byte* start = data + constant.offset;
+        if (constant.kind == ImageString) {
+            bytecode->constants.push_back(make_unique<String>(string((const char*) start, constant.length)));
+        } else if (constant.kind == ImageFunction) {
+            if (!inData(header, constant.positionsOffset, constant.positionsLength)) return 1;
+            const byte* positions = data + constant.positionsOffset;
+            auto fn = make_unique<CompiledFunction>(Instruction(start, start + constant.length),
+                PositionTable(positions, positions + constant.positionsLength));
+            fn->maxStack = constant.maxStack; // checked by the verifier before it is trusted
+            bytecode->constants.push_back(move(fn));
+        } else {
+            return 1; // unknown constant kind
+        }
+    }
+    for (uint32_t i = 0; i < header->numSymbols; i++) {
+        const ImageSymbol& symbol = symbolTable[i];
+        if (!inData(header, symbol.nameOffset, symbol.nameLength)) return 1;
+        symbols->defineAt(string((const char*) data + symbol.nameOffset, symbol.nameLength), symbol.index);
+    }
+    return 0;
+}
+
+/* Disassemble the main program and every function of an image straight from the
+mapping, without loading it */
+int disassembleImage(string path, ostream& out) {
+    MappedImage image(path);
+    const ImageHeader* header = validateImage(image);
+    if (header == nullptr) return 1; // not a valid image
+    const ImageConstant* constants = imageConstants(header);
+    const byte* data = imageData(header);
+
+    if (!inData(header, header->mainOffset, header->mainLength)) return 1;
+    out << "main:\n";
+    if (disassemble(out, InstructionRange(data + header->mainOffset, header->mainLength))) return 1;
+    out << "\n";
+    for (uint32_t i = 0; i < header->numConstants; i++) {
+        const ImageConstant& constant = constants[i];
+        if (constant.kind != ImageFunction) continue;
+        if (!inData(header, constant.offset, constant.length)) return 1;
+        out << "constant " << i << ":\n";
+        if (disassemble(out, InstructionRange(data + constant.offset, constant.length))) return 1;
+        out << "\n";
+    }
+    return 0;
+}
@@ -17,6 +17,8 @@ class Lexer {
     int currPos = 0; // position of current character
     int nextPos = 0; // after current char
     char currChar; // current character
+    int currLine = 1; // position of current character
+    int currColumn = 0;
 
     public:
     Lexer() = default;
@@ -32,6 +34,12 @@ class Lexer {
         if (nextPos > input.length()) {
             currChar = 0;
         } else {
+            if (nextPos > 0 && input[nextPos - 1] == '\n') {
+                currLine++;
+                currColumn = 1;
+            } else {
+                currColumn++;
+            }
             currChar = input[nextPos];
             currPos = nextPos;
             nextPos++;
@@ -73,6 +81,7 @@ class Lexer {
     Token nextToken() {
         Token token;
         skipWhitespace();
+        int line = currLine, column = currColumn;
         switch (currChar) {
             case '=':
                 if (peekChar() == '=') {
@@ -156,16 +165,22 @@ class Lexer {
                 if (isLetter(currChar)) {
                     token.literal = readIdentifier();
                     token.type = getType(token.literal);
+                    token.line = line;
+                    token.column = column;
                     return token; // already advanced to next char, so exit early
                 } else if (isDigit(currChar)) {
                     token.type = types.INT;
                     token.literal = readNumber();
+                    token.line = line;
+                    token.column = column;
                     return token;
                 } else {
                     token = NewToken(types.ILLEGAL, currChar);
                 }
         }
         readChar();
+        token.line = line;
+        token.column = column;
         return token;
     }
 };
@@ -1,10 +1,133 @@
 #include "repl.cpp"
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
 using namespace std;
 
+/* Compile a source file to a bytecode image that can be run later without the front end */
+int compileToImage(string sourcePath, string imagePath, CompilerOptions options) {
+    ifstream in(sourcePath);
+    if (!in) {
+        cout << "cannot open " << sourcePath << endl;
+        return 1;
+    }
+    stringstream source;
+    source << in.rdbuf();
+    Lexer l = Lexer(source.str());
+    Parser p = Parser(l);
+    auto program = Program();
+    if (p.parseProgram(&program)) {
+        cout << "error in parser..." << endl;
+        return 1;
+    }
+    auto compiler = Compiler(options);
+    if (compiler.compileProgram(&program)) {
+        cout << "error in compiler..." << endl;
+        return 1;
+    }
+    auto bytecode = compiler.getByteCode();
+    if (writeImage(imagePath, bytecode, compiler.getSymbolTable())) {
+        cout << "cannot write " << imagePath << endl;
+        return 1;
+    }
+    return 0;
+}
+
+/* gcThreshold of 0 keeps the default heap size before the first collection, a
+gcMaxPause above 0 collects incrementally in slices of that many milliseconds */
+int runImage(string imagePath, size_t gcThreshold, double gcMaxPause, bool gcStats) {
+    ByteCode bytecode;
+    SymbolTable symbols;
+    if (loadImage(imagePath, &bytecode, &symbols)) {
+        cout << "cannot load " << imagePath << endl;
+        return 1;
+    }
+    auto vm = VM(move(bytecode));
+    if (gcThreshold > 0) vm.heap.minThreshold = vm.heap.threshold = gcThreshold;
+    vm.heap.incremental = gcMaxPause > 0;
+    if (gcMaxPause > 0) vm.heap.maxPauseMs = gcMaxPause;
+    if (vm.run()) {
+        cout << "error in vm..." << endl;
+        return 1;
+    }
+    cout << vm.getLastPopped().serialize() << endl;
+    if (gcStats) cerr << vm.heap.report() << endl;
+    return 0;
+}
+
+/* Parse all of text as an integer in [min, max], returning 1 if it is not one */
+int parseInteger(const char* text, long long min, long long max, long long* value) {
+    char* end;
+    errno = 0;
+    long long n = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || n < min || n > max) return 1; // not a number in range
+    *value = n;
+    return 0;
+}
+
+/* Parse all of text as a finite number that is not negative */
+int parseNonNegative(const char* text, double* value) {
+    char* end;
+    errno = 0;
+    double n = strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE || !isfinite(n) || n < 0) return 1; // not a number in range
+    *value = n;
+    return 0;
+}
+
+int usage() {
+    cout << "usage: main [--opt-level 0-2] [--inline-budget bytes] [--inline-report]\n"
+        << "            [--compile source image | --run image | --disassemble image]\n"
+        << "            [--gc-threshold bytes] [--gc-max-pause ms] [--gc-stats]" << endl;
+    return 1;
+}
+
 int main(int argc, char** argv) {
     // cout << "Welcome to the Simply A Programming Language" << endl;
-    repl();
+    CompilerOptions options;
+    string compilePath = "", outputPath = "", imagePath = "", disassemblePath = "";
+    size_t gcThreshold = 0;
+    double gcMaxPause = 0;
+    bool gcStats = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        long long n;
+        if (arg == "--opt-level" && i + 1 < argc) {
+            if (parseInteger(argv[++i], 0, 2, &n)) return usage();
+            options.optimizationLevel = n;
+        } else if (arg == "--inline-budget" && i + 1 < argc) {
+            if (parseInteger(argv[++i], 0, INT_MAX, &n)) return usage();
+            options.inlineBudget = n;
+        } else if (arg == "--inline-report") {
+            options.inlineReport = true;
+        } else if (arg == "--compile" && i + 2 < argc) {
+            compilePath = argv[++i];
+            outputPath = argv[++i];
+        } else if (arg == "--run" && i + 1 < argc) {
+            imagePath = argv[++i];
+        } else if (arg == "--disassemble" && i + 1 < argc) {
+            disassemblePath = argv[++i];
+        } else if (arg == "--gc-threshold" && i + 1 < argc) {
+            if (parseInteger(argv[++i], 0, LLONG_MAX, &n)) return usage();
+            gcThreshold = n;
+        } else if (arg == "--gc-max-pause" && i + 1 < argc) {
+            if (parseNonNegative(argv[++i], &gcMaxPause)) return usage();
+        } else if (arg == "--gc-stats") {
+            gcStats = true;
+        }
+    }
+    if (compilePath != "") return compileToImage(compilePath, outputPath, options);
+    if (imagePath != "") return runImage(imagePath, gcThreshold, gcMaxPause, gcStats);
+    if (disassemblePath != "") {
+        if (disassembleImage(disassemblePath, cout) == 0) return 0;
+        cout << "cannot disassemble " << disassemblePath << endl;
+        return 1;
+    }
+    repl(options);
     return 0;
-}
\ No newline at end of file
+}
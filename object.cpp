@@ -1,5 +1,10 @@
 #include<iostream>
 #include<functional>
+#include<memory>
+#include<vector>
+#ifdef __SSE2__
+#include<emmintrin.h>
+#endif
 #include"bytecode.cpp"
 
 using namespace std;
@@ -10,35 +15,142 @@ struct ObjTypes {
     string NULL_OBJ = "NULL";
     string STRING_OBJ = "STRING";
     string ARRAY_OBJ = "ARRAY";
-    string HASH_OBJ = "HASH_PAIR";
     string HASH_TABLE = "HASH_TABLE";
     string COMPILED_FUNCTION_OBJ = "COMPILED_FUNCTION";
 } objs;
 
+/* One byte naming the class of an object, in the order of kindNames */
+enum ObjectKind : uint8_t {
+    IntegerObject,
+    BooleanObject,
+    NullObject,
+    StringObject,
+    ArrayObject,
+    HashTableObject,
+    CompiledFunctionObject
+};
+
+const string* kindNames[] = {&objs.INTEGER_OBJ, &objs.BOOLEAN_OBJ, &objs.NULL_OBJ, &objs.STRING_OBJ,
+    &objs.ARRAY_OBJ, &objs.HASH_TABLE, &objs.COMPILED_FUNCTION_OBJ};
+
+/* The header is 24 bytes with the vtable pointer. Type tests compare kind and
+static_cast; getType is for messages and tests. */
 class Object {
     public:
-    string type;
+    Object* next = nullptr; // every object of a heap is on its list, see Heap
+    uint32_t heapSize = 0; // bytes charged to the heap
+    uint16_t blockSize = 0; // of the heap's slab block holding the object, 0 if allocated with new
+    ObjectKind kind; // never changes
+    bool marked = false;
+
+    Object(ObjectKind kind) : kind(kind) {};
     virtual ~Object() = default;
     virtual string serialize() const = 0;
-    virtual string getType() const = 0;
+    const string& getType() const {
+        return *kindNames[kind];
+    }
     virtual bool hashable() const = 0;
+    virtual size_t footprint() const { return sizeof(Object); } // bytes held, including owned buffers
+    virtual void trace(vector<Object*>* gray) const {} // mark the objects this one refers to
+};
+
+static_assert(sizeof(Object) <= 24, "object header grew");
+
+/******************** values *******************/
+/* What the VM computes with, in 16 bytes. Integers, booleans and null are held
+inline; strings, arrays, hashes and functions are objects of the VM's heap, which
+frees them once no value reaches them. Copying a value is a plain copy. Empty
+marks a slot that was never written. */
+enum ValueKind : uint8_t {
+    EmptyValue,
+    NullValue,
+    BooleanValue,
+    IntegerValue,
+    ObjectValue
+};
+
+class Value {
+    public:
+    ValueKind kind;
+    union {
+        int integer;
+        bool boolean;
+        Object* object;
+        uint64_t bits; // the whole payload, for moves
+    };
+
+    Value() : kind(EmptyValue), bits(0) {};
+    explicit Value(ValueKind kind) : kind(kind), bits(0) {};
+
+    bool empty() const {
+        return kind == EmptyValue;
+    }
+
+    string serialize() const {
+        switch (kind) {
+            case NullValue: return "null";
+            case BooleanValue: return boolean ? "true" : "false";
+            case IntegerValue: return to_string(integer);
+            case ObjectValue: return object->serialize();
+            default: return "";
+        }
+    }
+
+    const string& getType() const {
+        static const string none = "";
+        switch (kind) {
+            case NullValue: return objs.NULL_OBJ;
+            case BooleanValue: return objs.BOOLEAN_OBJ;
+            case IntegerValue: return objs.INTEGER_OBJ;
+            case ObjectValue: return object->getType();
+            default: return none;
+        }
+    }
+
+    bool hashable() const {
+        return kind == BooleanValue || kind == IntegerValue || (kind == ObjectValue && object->hashable());
+    }
 };
+static_assert(sizeof(Value) == 16, "values are passed around by the VM at every step");
+
+/* Mark the object a value points at, if any, and queue it to have its own
+references marked */
+inline void markValue(const Value& value, vector<Object*>* gray) {
+    if (value.kind != ObjectValue || value.object->marked) return;
+    value.object->marked = true;
+    gray->push_back(value.object);
+}
+
+Value nullValue() {
+    return Value(NullValue);
+}
 
+Value booleanValue(bool boolean) {
+    Value value(BooleanValue);
+    value.boolean = boolean;
+    return value;
+}
+
+Value integerValue(int integer) {
+    Value value(IntegerValue);
+    value.integer = integer;
+    return value;
+}
+
+/* Integer literals the compiler keeps a single shared constant for */
+const int smallIntegerMin = -128;
+const int smallIntegerMax = 1023;
 
 class Integer: public Object {
     public:
     int value;
-    string type = objs.INTEGER_OBJ;
 
-    Integer(int val) : value(val) {};
+    Integer(int val) : Object(IntegerObject), value(val) {};
 
     string serialize() const override {
         return to_string(value);
     }
 
-    string getType() const override {
-        return type;
-    }
 
     bool hashable() const override {
         return true;
@@ -48,17 +160,13 @@ class Integer: public Object {
 class Boolean: public Object {
     public:
     bool value;
-    string type = objs.BOOLEAN_OBJ;
 
-    Boolean(bool val) : value(val) {};
+    Boolean(bool val) : Object(BooleanObject), value(val) {};
 
     string serialize() const override {
         return value ? "true" : "false";
     }
 
-    string getType() const override {
-        return type;
-    }
 
     bool hashable() const override {
         return true;
@@ -67,16 +175,12 @@ class Boolean: public Object {
 
 class Null: public Object {
     public:
-    string type = objs.NULL_OBJ;
 
-    Null() = default;
+    Null() : Object(NullObject) {};
 
     string serialize() const override {
         return "null";
     }
-    string getType() const override {
-        return type;
-    }
     bool hashable() const override {
         return false;
     }
@@ -84,17 +188,16 @@ class Null: public Object {
 
 class String: public Object {
     public:
-    string type = objs.STRING_OBJ;
     string value;
 
-    String() = default;
-    String(string val) : value(val) {};
+    String() : Object(StringObject) {};
+    String(string val) : Object(StringObject), value(val) {};
 
     string serialize() const override {
         return value;
     }
-    string getType() const override {
-        return type;
+    size_t footprint() const override {
+        return sizeof(String) + value.capacity();
     }
     bool hashable() const override {
         return true;
@@ -103,117 +206,300 @@ class String: public Object {
 
 class Array: public Object {
     public:
-    string type = objs.ARRAY_OBJ;
-    vector<unique_ptr<Object>> elements;
+    vector<Value> elements;
+
+    Array(vector<Value>&& elements) : Object(ArrayObject), elements(move(elements)) {};
 
-    Array(vector<unique_ptr<Object>>&& elements) : elements(move(elements)) {};
+    size_t footprint() const override {
+        return sizeof(Array) + elements.capacity() * sizeof(Value);
+    }
+    void trace(vector<Object*>* gray) const override {
+        for (auto& element : elements) markValue(element, gray);
+    }
 
     string serialize() const override {
         string res = "[";
         int i = 0;
         for (auto& element : elements) {
-            res += element.get()->serialize();
+            res += element.serialize();
             if (i++ < elements.size() - 1) res += ", ";
         }
         res += "]";
         return res;
     }
-    string getType() const override {
-        return type;
-    }
     bool hashable() const override {
         return false;
     }
 };
 
-typedef size_t HashKey;
+/******************** hash tables *******************/
+/* Flat open addressing in the style of Swiss tables. Slots come in groups of
+hashGroupWidth, with a control byte per slot that is hashEmpty or the low 7 bits
+of the hash of the entry in the slot. A lookup matches the bits of its hash
+against a whole group of control bytes at once, with SSE2 where there is one,
+and compares keys only in the slots that matched. Groups are probed in
+triangular steps over a power of two, and a table grows before it is 7/8 full,
+so every probe ends at a group with an empty slot. Slots hold the index of their
+entry; entries are kept in insertion order, which is the order of iteration.
+Tables are built once and never lose entries, so there are no tombstones. */
+const int hashGroupWidth = 16;
+const int8_t hashEmpty = -128;
+
+inline uint64_t mixHash(uint64_t x) {
+    x *= 0x9E3779B97F4A7C15ull;
+    return x ^ (x >> 32);
+}
+
+/* Bit i is set where control byte i of the group equals byte */
+inline uint32_t matchGroup(const int8_t* group, int8_t byte) {
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128((const __m128i*) group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < hashGroupWidth; i++) mask |= (uint32_t) (group[i] == byte) << i;
+    return mask;
+#endif
+}
 
-class HashPair: public Object {
+inline int lowestBit(uint32_t mask) {
+#ifdef __GNUC__
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while ((mask & 1) == 0) mask >>= 1, i++;
+    return i;
+#endif
+}
+
+/* Entry layouts, chosen by the keys of a table. Integer keys are held as ints
+and hashed again when the table grows; string keys keep their hash and the
+string object; any other mix keeps the hash and the key value. */
+struct IntEntry {
+    int key;
+    Value value;
+
+    static bool accepts(const Value& key) { return key.kind == IntegerValue; }
+    static uint64_t hashOf(const Value& key) { return mixHash((uint32_t) key.integer); }
+    IntEntry(const Value& key, const Value& value, uint64_t hash) : key(key.integer), value(value) {};
+    uint64_t hash() const { return mixHash((uint32_t) key); }
+    bool matches(const Value& other, uint64_t hash) const { return key == other.integer; }
+    Value keyValue() const { return integerValue(key); }
+};
+
+struct StringEntry {
+    uint64_t keyHash;
+    String* key;
+    Value value;
+
+    static bool accepts(const Value& key) { return key.kind == ObjectValue && key.object->kind == StringObject; }
+    static uint64_t hashOf(const Value& key) { return mixHash(std::hash<string>{}(static_cast<String*>(key.object)->value)); }
+    StringEntry(const Value& key, const Value& value, uint64_t hash) : keyHash(hash), key(static_cast<String*>(key.object)), value(value) {};
+    uint64_t hash() const { return keyHash; }
+    bool matches(const Value& other, uint64_t hash) const {
+        return keyHash == hash && (key == other.object || key->value == static_cast<String*>(other.object)->value);
+    }
+    Value keyValue() const {
+        Value value(ObjectValue);
+        value.object = key;
+        return value;
+    }
+};
+
+struct ValueEntry {
+    uint64_t keyHash;
+    Value key;
+    Value value;
+
+    static bool accepts(const Value& key) { return key.hashable(); }
+    static uint64_t hashOf(const Value& key) {
+        if (StringEntry::accepts(key)) return StringEntry::hashOf(key);
+        return mixHash(key.bits ^ ((uint64_t) key.kind << 40)); // true and 1 differ
+    }
+    ValueEntry(const Value& key, const Value& value, uint64_t hash) : keyHash(hash), key(key), value(value) {};
+    uint64_t hash() const { return keyHash; }
+    bool matches(const Value& other, uint64_t hash) const {
+        if (keyHash != hash || key.kind != other.kind) return false;
+        if (key.kind != ObjectValue) return key.bits == other.bits;
+        return static_cast<String*>(key.object)->value == static_cast<String*>(other.object)->value;
+    }
+    Value keyValue() const { return key; }
+};
+
+template<typename Entry> class FlatTable {
     public:
-    string type = objs.HASH_OBJ;
-    unique_ptr<Object> key;
-    unique_ptr<Object> value;
+    vector<Entry> entries; // in insertion order
+    vector<int8_t> control; // a byte per slot
+    vector<uint32_t> slots; // index of the slot's entry
+
+    const Entry* find(const Value& key) const {
+        if (control.empty() || !Entry::accepts(key)) return nullptr;
+        uint64_t hash = Entry::hashOf(key);
+        size_t mask = control.size() / hashGroupWidth - 1;
+        size_t group = (hash >> 7) & mask;
+        for (size_t step = 1; ; step++) {
+            const int8_t* bytes = &control[group * hashGroupWidth];
+            for (uint32_t match = matchGroup(bytes, hash & 0x7f); match != 0; match &= match - 1) {
+                const Entry& entry = entries[slots[group * hashGroupWidth + lowestBit(match)]];
+                if (entry.matches(key, hash)) return &entry;
+            }
+            if (matchGroup(bytes, hashEmpty) != 0) return nullptr;
+            group = (group + step) & mask;
+        }
+    }
 
-    HashPair(unique_ptr<Object>& key, unique_ptr<Object>& val) : key(move(key)), value(move(val)) {};
-    string serialize() const override {
-        string res = key.get()->serialize();
-        res += ": ";
-        res += value.get()->serialize();
-        return res;
+    /* A key already in the table gets the new value */
+    void insert(const Value& key, const Value& value) {
+        const Entry* found = find(key);
+        if (found != nullptr) {
+            const_cast<Entry*>(found)->value = value;
+            return;
+        }
+        if ((entries.size() + 1) * 8 > control.size() * 7) grow();
+        uint64_t hash = Entry::hashOf(key);
+        entries.emplace_back(key, value, hash);
+        place(entries.size() - 1, hash);
     }
-    string getType() const override {
-        return type;
+
+    void reserve(size_t n) {
+        entries.reserve(n);
+        size_t capacity = hashGroupWidth;
+        while (n * 8 > capacity * 7) capacity *= 2;
+        if (capacity > control.size()) rehash(capacity);
     }
-    bool hashable() const override {
-        return false;
+
+    private:
+    void grow() {
+        rehash(control.empty() ? hashGroupWidth : control.size() * 2);
+    }
+
+    void rehash(size_t capacity) {
+        control.assign(capacity, hashEmpty);
+        slots.assign(capacity, 0);
+        for (uint32_t i = 0; i < entries.size(); i++) place(i, entries[i].hash());
+    }
+
+    void place(uint32_t index, uint64_t hash) {
+        size_t mask = control.size() / hashGroupWidth - 1;
+        size_t group = (hash >> 7) & mask;
+        for (size_t step = 1; ; step++) {
+            uint32_t empty = matchGroup(&control[group * hashGroupWidth], hashEmpty);
+            if (empty != 0) {
+                size_t slot = group * hashGroupWidth + lowestBit(empty);
+                control[slot] = hash & 0x7f;
+                slots[slot] = index;
+                return;
+            }
+            group = (group + step) & mask;
+        }
     }
 };
 
+/* The hash object. The VM picks the entry layout from the keys when it builds
+a table, see OpHash. */
 class HashTable : public Object {
     public:
-    string type = objs.HASH_TABLE;
-    map<HashKey, unique_ptr<HashPair>> table;
+    HashTable() : Object(HashTableObject) {};
 
-    HashTable(map<HashKey, unique_ptr<HashPair>> table) : table(move(table)) {};
+    virtual const Value* get(const Value& key) const = 0; // nullptr if the key is not in the table
+    virtual size_t size() const = 0;
+    virtual Value key(size_t i) const = 0; // of the i-th entry inserted
+    virtual const Value& value(size_t i) const = 0;
 
     string serialize() const override {
         string res = "{";
-        int i = 0;
-        for (auto& entry : table) {
-            res += entry.second.get()->serialize();
-            if (i++ < table.size() - 1) res += ", ";
+        for (size_t i = 0; i < size(); i++) {
+            if (i > 0) res += ", ";
+            res += key(i).serialize() + ": " + value(i).serialize();
         }
         res += "}";
         return res;
     }
-    string getType() const override {return type;}
     bool hashable() const override {
         return false;
     }
 };
 
-HashKey hashKey(unique_ptr<Object>& obj) {
-    string type = obj.get()->getType();
-    if (type == objs.INTEGER_OBJ) {
-        Integer* lit = dynamic_cast<Integer*>(obj.get());
-        return hash<int>{}(lit->value);
-    } else if (type == objs.BOOLEAN_OBJ) {
-        Boolean* lit = dynamic_cast<Boolean*>(obj.get());
-        return hash<bool>{}(lit->value);
-    } else if (type == objs.STRING_OBJ) {
-        String* lit = dynamic_cast<String*>(obj.get());
-        return hash<string>{}(lit->value);
-    } else {
-        return 0;
+template<typename Entry> class FlatHashTable : public HashTable {
+    public:
+    FlatTable<Entry> table;
+
+    FlatHashTable(FlatTable<Entry>&& table) : table(move(table)) {};
+
+    const Value* get(const Value& key) const override {
+        const Entry* entry = table.find(key);
+        return entry == nullptr ? nullptr : &entry->value;
+    }
+    size_t size() const override {
+        return table.entries.size();
     }
+    Value key(size_t i) const override {
+        return table.entries[i].keyValue();
+    }
+    const Value& value(size_t i) const override {
+        return table.entries[i].value;
+    }
+
+    size_t footprint() const override {
+        return sizeof(FlatHashTable) + table.entries.capacity() * sizeof(Entry)
+            + table.control.capacity() + table.slots.capacity() * sizeof(uint32_t);
+    }
+    void trace(vector<Object*>* gray) const override {
+        for (auto& entry : table.entries) {
+            markValue(entry.keyValue(), gray);
+            markValue(entry.value, gray);
+        }
+    }
+};
+
+/* The table of n / 2 keys and values, alternating from pairs on. Later keys win. */
+template<typename Entry> FlatTable<Entry> buildTable(const Value* pairs, int n) {
+    FlatTable<Entry> table;
+    table.reserve(n / 2);
+    for (int i = 0; i < n; i += 2) table.insert(pairs[i], pairs[i + 1]);
+    return table;
 }
 
+/* Code in the form the VM runs it, see predecode */
+typedef vector<uint32_t> SlotCode;
+
 class CompiledFunction : public Object {
     public:
-    string type = objs.COMPILED_FUNCTION_OBJ;
     Instruction instructions;
+    PositionTable positions; // only read offline, by profilers and error reporting
+    int maxStack = -1; // deepest operand stack of a call, -1 if unknown
+    shared_ptr<const SlotCode> slots; // set when a VM loads the function, shared by its copies
 
-    CompiledFunction(Instruction instructions) : instructions(instructions) {};
+    CompiledFunction(Instruction instructions, PositionTable positions = PositionTable()) : Object(CompiledFunctionObject), instructions(instructions), positions(positions) {};
 
     string serialize() const override {
         return "compiled function";
     };
-    string getType() const override {
-        return type;
-    };
+    size_t footprint() const override {
+        return sizeof(CompiledFunction) + instructions.capacity() + positions.capacity();
+    }
     bool hashable() const override {
         return false;
     }
 };
 
+/* Bytes per object of every class, header and vtable pointer included, not
+counting buffers the object owns */
+string objectSizeReport() {
+    vector<pair<ObjectKind, size_t>> sizes = {{IntegerObject, sizeof(Integer)}, {BooleanObject, sizeof(Boolean)},
+        {NullObject, sizeof(Null)}, {StringObject, sizeof(String)}, {ArrayObject, sizeof(Array)},
+        {HashTableObject, sizeof(FlatHashTable<ValueEntry>)}, {CompiledFunctionObject, sizeof(CompiledFunction)}};
+    string report = "header: " + to_string(sizeof(Object)) + " bytes";
+    for (auto& size : sizes) report += ", " + *kindNames[size.first] + ": " + to_string(size.second);
+    report += "; hash entries: int keys " + to_string(sizeof(IntEntry)) + ", string keys " + to_string(sizeof(StringEntry))
+        + ", other " + to_string(sizeof(ValueEntry));
+    return report;
+}
+
 class Frame {
     public:
-    CompiledFunction fn;
+    const SlotCode* code; // owned by the function called, which stays on the stack until the frame returns
     int ip;
 
-    Frame(CompiledFunction& fn) : fn(fn), ip(0) {};
-
-    Instruction getInstructions() {
-        return fn.instructions;
-    }
+    Frame(const SlotCode* code) : code(code), ip(0) {};
 };
\ No newline at end of file
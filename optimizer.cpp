@@ -0,0 +1,251 @@
+#include<iostream>
+#include<vector>
+
+using namespace std;
+
+/******************** dead code elimination *******************/
+struct OptInstruction {
+    OpCode opcode;
+    vector<int> operands;
+    int target = -1; // index of the jump target, instructions.size() for the end
+    bool removed = false;
+    SourcePos pos;
+};
+
+bool isJump(OpCode opcode) {
+    return opcode == OpJump || opcode == OpJumpIfFalse || opcode == OpLoop;
+}
+
+/* Control never falls through to the next instruction */
+bool isTerminator(OpCode opcode) {
+    return opcode == OpJump || opcode == OpLoop || opcode == OpRetVal || opcode == OpRet;
+}
+
+/* positions, if given, holds one source position per byte of instructions */
+vector<OptInstruction> decodeInstructions(const Instruction& instructions, const vector<SourcePos>* positions = nullptr) {
+    vector<OptInstruction> res;
+    map<int, int> offsetToIndex;
+    vector<int> targetOffsets;
+    for (auto& ins : InstructionRange(instructions)) {
+        vector<int> operands(ins.operands, ins.operands + ins.operandCount);
+        offsetToIndex[ins.offset] = res.size();
+        targetOffsets.push_back(isJump(ins.opcode) ? ins.offset + ins.length + operands.at(0) : -1);
+        res.push_back(OptInstruction{ins.opcode, operands});
+        if (positions != nullptr) res.back().pos = positions->at(ins.offset);
+    }
+    offsetToIndex[instructions.size()] = res.size();
+    for (int i = 0; i < res.size(); i++) {
+        if (targetOffsets.at(i) >= 0) res.at(i).target = offsetToIndex.at(targetOffsets.at(i));
+    }
+    return res;
+}
+
+/* First instruction at or after idx that has not been removed */
+int nextLive(const vector<OptInstruction>& code, int idx) {
+    while (idx < code.size() && code.at(idx).removed) idx++;
+    return idx;
+}
+
+/* Fold jumps on constant conditions. OpTrue; OpJumpIfFalse never jumps and
+OpFalse/OpNull; OpJumpIfFalse always does. The pair is only folded when nothing
+jumps into the middle of it. */
+bool foldConstantBranches(vector<OptInstruction>& code, const vector<bool>& isTarget) {
+    bool changed = false;
+    for (int i = 0; i < code.size(); i++) {
+        if (code.at(i).removed) continue;
+        OpCode opcode = code.at(i).opcode;
+        if (opcode != OpTrue && opcode != OpFalse && opcode != OpNull) continue;
+        int next = nextLive(code, i + 1);
+        if (next == code.size() || code.at(next).opcode != OpJumpIfFalse || isTarget.at(next)) continue;
+        code.at(i).removed = true;
+        if (opcode == OpTrue) {
+            code.at(next).removed = true;
+        } else {
+            code.at(next).opcode = OpJump;
+        }
+        changed = true;
+    }
+    return changed;
+}
+
+bool removeUnreachable(vector<OptInstruction>& code) {
+    vector<bool> reachable(code.size(), false);
+    vector<int> worklist = {nextLive(code, 0)};
+    while (!worklist.empty()) {
+        int idx = worklist.back();
+        worklist.pop_back();
+        if (idx >= code.size() || reachable.at(idx)) continue;
+        reachable.at(idx) = true;
+        auto& ins = code.at(idx);
+        if (isJump(ins.opcode)) worklist.push_back(nextLive(code, ins.target));
+        if (!isTerminator(ins.opcode)) worklist.push_back(nextLive(code, idx + 1));
+    }
+    bool changed = false;
+    for (int i = 0; i < code.size(); i++) {
+        if (!code.at(i).removed && !reachable.at(i)) {
+            code.at(i).removed = true;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/* A jump to the instruction right after it does nothing except, for
+OpJumpIfFalse, pop its condition */
+bool removeJumpsToNext(vector<OptInstruction>& code) {
+    bool changed = false;
+    for (int i = 0; i < code.size(); i++) {
+        auto& ins = code.at(i);
+        if (ins.removed || !isJump(ins.opcode)) continue;
+        if (nextLive(code, ins.target) != nextLive(code, i + 1)) continue;
+        if (ins.opcode == OpJump) ins.removed = true;
+        else ins = OptInstruction{OpPop, vector<int>{}, -1, false, ins.pos};
+        changed = true;
+    }
+    return changed;
+}
+
+/* Lay out the live instructions, widening relative jumps until every offset fits.
+positions, if given, receives the source position of every byte. */
+Instruction encodeInstructions(vector<OptInstruction>& code, vector<SourcePos>* positions = nullptr) {
+    vector<int> wide(code.size(), 0);
+    vector<int> offsets(code.size() + 1, 0);
+    vector<Instruction> encoded; // one per instruction, empty if removed
+    encoded.reserve(code.size());
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        int offset = 0;
+        encoded.clear();
+        for (int i = 0; i < code.size(); i++) {
+            offsets.at(i) = offset;
+            if (code.at(i).removed) {
+                encoded.emplace_back();
+                continue;
+            }
+            auto operands = isJump(code.at(i).opcode) ? vector<int>{0} : code.at(i).operands;
+            encoded.emplace_back(constructByteCode(code.at(i).opcode, operands, wide.at(i)));
+            offset += encoded.back().size();
+        }
+        offsets.at(code.size()) = offset;
+        for (int i = 0; i < code.size(); i++) {
+            auto& ins = code.at(i);
+            if (ins.removed || !isJump(ins.opcode)) continue;
+            int rel = offsets.at(nextLive(code, ins.target)) - (offsets.at(i) + encoded.at(i).size());
+            encoded.at(i) = constructByteCode(ins.opcode, vector<int>{rel}, wide.at(i));
+            if (encoded.at(i).size() != constructByteCode(ins.opcode, vector<int>{0}, wide.at(i)).size()) {
+                wide.at(i)++;
+                changed = true;
+            }
+        }
+    }
+    Instruction res;
+    if (positions != nullptr) positions->clear();
+    for (int i = 0; i < code.size(); i++) {
+        if (code.at(i).removed) continue;
+        res.insert(res.end(), encoded.at(i).begin(), encoded.at(i).end());
+        if (positions != nullptr) positions->insert(positions->end(), encoded.at(i).size(), code.at(i).pos);
+    }
+    return res;
+}
+
+/* Remove unreachable instructions and branches on constant conditions, then
+compact the instruction stream and re-patch relative jumps. positions, if given,
+is updated to match. */
+Instruction eliminateDeadCode(const Instruction& instructions, vector<SourcePos>* positions = nullptr) {
+    auto code = decodeInstructions(instructions, positions);
+    bool changed = true;
+    while (changed) {
+        vector<bool> isTarget(code.size() + 1, false);
+        for (auto& ins : code) {
+            if (!ins.removed && isJump(ins.opcode)) isTarget.at(nextLive(code, ins.target)) = true;
+        }
+        changed = foldConstantBranches(code, isTarget);
+        changed |= removeUnreachable(code);
+        changed |= removeJumpsToNext(code);
+    }
+    return encodeInstructions(code, positions);
+}
+
+/******************** inlining *******************/
+/* Turn the body of a compiled function into code that runs in the caller and
+leaves the return value on the stack: every return becomes a jump to the end.
+positions, if given, is updated to match. */
+Instruction inlineBody(const Instruction& body, vector<SourcePos>* positions = nullptr) {
+    auto code = decodeInstructions(body, positions);
+    vector<OptInstruction> res;
+    vector<int> newIndex(code.size() + 1, 0);
+    vector<int> returns;
+    for (int i = 0; i < code.size(); i++) {
+        newIndex.at(i) = res.size();
+        auto ins = code.at(i);
+        if (ins.opcode == OpRet) res.push_back(OptInstruction{OpNull, vector<int>{}, -1, false, ins.pos});
+        if (ins.opcode == OpRet || ins.opcode == OpRetVal) {
+            ins = OptInstruction{OpJump, vector<int>{0}, -1, false, ins.pos};
+            returns.push_back(res.size());
+        }
+        res.push_back(ins);
+    }
+    newIndex.at(code.size()) = res.size();
+    for (auto& ins : res) {
+        if (ins.target >= 0) ins.target = newIndex.at(ins.target);
+    }
+    for (int idx : returns) res.at(idx).target = res.size();
+    removeJumpsToNext(res);
+    return encodeInstructions(res, positions);
+}
+
+/******************** stack depth *******************/
+/* Deepest operand stack the code reaches, relative to the start of its frame.
+Fails if the code does not decode, a jump lands inside an instruction, two paths
+reach an instruction with different depths, or the stack underflows. A function
+must return with exactly its value on the frame; the main program must not return. */
+int stackDepth(const byte* code, int size, bool function, int* maxDepth) {
+    vector<DecodedInstruction> instructions;
+    vector<int> indexAt(size + 1, -1);
+    for (auto& ins : InstructionRange(code, size)) {
+        if (!ins.valid) return 1; // unknown opcode or truncated operand
+        indexAt.at(ins.offset) = instructions.size();
+        instructions.push_back(ins);
+    }
+    indexAt.at(size) = instructions.size();
+
+    vector<int> depth(instructions.size() + 1, -1); // before each instruction, -1 if not reached yet
+    vector<int> worklist;
+    auto reach = [&](int idx, int d) {
+        if (depth.at(idx) == d) return 0;
+        if (depth.at(idx) != -1) return 1; // paths disagree on the stack depth
+        depth.at(idx) = d;
+        worklist.push_back(idx);
+        return 0;
+    };
+    *maxDepth = 0;
+    if (reach(0, 0)) return 1;
+    while (!worklist.empty()) {
+        int idx = worklist.back();
+        worklist.pop_back();
+        if (idx == instructions.size()) {
+            if (function) return 1; // control runs off the end of a function
+            continue;
+        }
+        auto& ins = instructions.at(idx);
+        const Definition& def = defs[ins.opcode];
+        int d = depth.at(idx);
+        if (ins.opcode == OpRetVal || ins.opcode == OpRet) {
+            if (!function) return 1; // nothing to return to
+            if (d != (ins.opcode == OpRetVal ? 1 : 0)) return 1; // frame not balanced on return
+            continue;
+        }
+        int pops = def.pops >= 0 ? def.pops : ins.operands[0];
+        if (d < pops) return 1; // stack underflow
+        int next = d - pops + def.pushes;
+        *maxDepth = max(*maxDepth, next);
+        if (isJump(ins.opcode)) {
+            int target = ins.offset + ins.length + ins.operands[0];
+            if (target < 0 || target > size || indexAt.at(target) < 0) return 1; // jump into the middle of an instruction
+            if (reach(indexAt.at(target), next)) return 1;
+        }
+        if (!isTerminator(ins.opcode) && reach(idx + 1, next)) return 1;
+    }
+    return 0;
+}
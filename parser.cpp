@@ -37,6 +37,7 @@ class Parser {
     void parseLetStatement(LetStatement* statement);
     void parseReturnStatement(ReturnStatement* statement);
     void parseExpressionStatement(ExpressionStatement* statement);
+    unique_ptr<Statement> parseWhileStatement();
 
     unique_ptr<BlockStatement> parseBlockStatement();
 
@@ -104,6 +105,13 @@ void Parser::parseStatement(Program* program) {
             program->statements.push_back(make_unique<ReturnStatement>(statement.token, statement.value));
         }
     } 
+    // While statements
+    else if (currTok.type == types.WHILE) {
+        unique_ptr<Statement> statement = parseWhileStatement();
+        if (statement != nullptr) {
+            program->statements.push_back(move(statement));
+        }
+    }
     // Expression statements
     else {
         ExpressionStatement statement = ExpressionStatement();
@@ -164,6 +172,30 @@ void Parser::parseExpressionStatement(ExpressionStatement* stmt) {
         readToken();
     }
 }
+unique_ptr<Statement> Parser::parseWhileStatement() {
+    Token tok = currTok;
+    readToken(); // skip 'while'
+    if (currTok.type != types.LPAREN) {
+        errors.push_back("Expected '(', but instead got '" + currTok.literal + "'");
+        return nullptr;
+    }
+
+    unique_ptr<Expression> condition = parseGroupedExpression();
+    if (condition == nullptr) {
+        errors.push_back("Cannot parse condition of while statement");
+        return nullptr;
+    } else readToken(); // skip ')'
+
+    if (currTok.type != types.LBRACE) {
+        errors.push_back("No block statement after while condition; Expected '{', but instead got '" + currTok.literal + "'");
+        return nullptr;
+    }
+    unique_ptr<BlockStatement> body = parseBlockStatement();
+    if (body == nullptr) return nullptr;
+    /* Optional semicolon */
+    if (nextTok.type == types.SEMICOLON) readToken();
+    return make_unique<WhileStatement>(tok, condition, body);
+}
 unique_ptr<BlockStatement> Parser::parseBlockStatement() {
     Token tok = currTok;
     readToken(); // skip '{'
@@ -369,7 +401,7 @@ unique_ptr<Expression> Parser::parseInfixExpression(unique_ptr<Expression>& left
 }
 
 unique_ptr<Expression> Parser::parseCallExpression(unique_ptr<Expression>& function) {
-    Token tok = Token{types.FUNCTION, function.get()->serialize()}; // token type is function
+    Token tok = Token{types.FUNCTION, function.get()->serialize(), currTok.line, currTok.column}; // token type is function, positioned at '(' 
     vector<unique_ptr<Expression>> args = {};
     readToken(); // skip '('
     while (currTok.type != types.RPAREN) {
@@ -0,0 +1,56 @@
+#include"verifier.cpp"
+#include<cstring>
+#include<deque>
+#include<vector>
+
+using namespace std;
+
+/******************** pre-decoded code *******************/
+/* The VM does not run bytecode directly. At load time every function is translated
+into fixed-width 32-bit slots: the opcode, then each operand already decoded, with
+no OpWide prefixes. Jump operands become the absolute slot index of the target,
+and the operand of OpConstant the Value it loads, spread over pointerSlots slots. */
+const int pointerSlots = sizeof(Value*) / sizeof(uint32_t);
+
+Value* readPointer(const uint32_t* slot) {
+    Value* value;
+    memcpy(&value, slot, sizeof(value));
+    return value;
+}
+
+int slotCount(const DecodedInstruction& ins) {
+    if (ins.opcode == OpConstant) return 1 + pointerSlots;
+    return 1 + ins.operandCount;
+}
+
+/* Fails on code that does not decode, jumps inside an instruction or loads a
+constant that does not exist. constants must keep their addresses while the code runs. */
+int predecode(const Instruction& instructions, deque<Value>& constants, SlotCode* code) {
+    map<int, int> slotAt; // instruction offset to slot index
+    int size = 0;
+    for (auto& ins : InstructionRange(instructions)) {
+        if (!ins.valid) return 1; // unknown opcode or truncated operand
+        slotAt[ins.offset] = size;
+        size += slotCount(ins);
+    }
+    slotAt[instructions.size()] = size;
+
+    code->clear();
+    code->reserve(size);
+    for (auto& ins : InstructionRange(instructions)) {
+        code->push_back((uint32_t) ins.opcode);
+        if (ins.opcode == OpConstant) {
+            if (ins.operands[0] >= constants.size()) return 1; // no such constant
+            Value* value = &constants.at(ins.operands[0]);
+            code->resize(code->size() + pointerSlots);
+            memcpy(code->data() + code->size() - pointerSlots, &value, sizeof(value));
+        } else if (isJump(ins.opcode)) {
+            auto target = slotAt.find(ins.offset + ins.length + ins.operands[0]);
+            if (target == slotAt.end()) return 1; // jump inside an instruction
+            code->push_back(target->second);
+        } else {
+            for (int i = 0; i < ins.operandCount; i++) code->push_back(ins.operands[i]);
+        }
+    }
+    return 0;
+}
@@ -1,36 +1,21 @@
 // #include"parser.cpp"
 #include<iostream>
-#include"vm.cpp"
+#include"session.cpp"
 
 using namespace std;
 
 #define MAX_INPUT_LENGTH 200
 
-void repl() {
-    // auto constants = vector<unique_ptr<Object>>();
-    // auto globals = vector<unique_ptr<Object>>(globalsSize);
-    // auto symbolTable = SymbolTable();
-    // auto compiler = Compiler();
+void repl(CompilerOptions options) {
+    auto session = Session(options);
     while (1) {
         cout << "> ";
         char input[MAX_INPUT_LENGTH];
-        cin.getline(input, MAX_INPUT_LENGTH, '\n');
+        if (!cin.getline(input, MAX_INPUT_LENGTH, '\n')) break;
 
-        Lexer l = Lexer(input);
-        Parser p = Parser(l);
-        auto program = Program();
-        int error = p.parseProgram(&program);
-        if (error) cout << "test failed due to error in parser..." << endl;
-
-        auto compiler = Compiler();
-        int err = compiler.compileProgram(&program);
-        if (err) cout << "test failed due to error in compiler..." << endl;
-
-        // auto bytecode = compiler.getByteCode();
-        auto vm = VM(compiler.getByteCode());
-        if (vm.run()) cout << "test failed due to error in vm..." << endl;
-
-        cout << vm.getLastPopped().get()->serialize() << endl;
-        // cin.clear();
+        string result;
+        session.eval(input, &result);
+        if (options.inlineReport) cout << session.compiler.inlineReport();
+        if (result != "") cout << result << endl;
     }
-};
\ No newline at end of file
+};
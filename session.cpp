@@ -0,0 +1,51 @@
+#include"vm.cpp"
+
+using namespace std;
+
+/******************** incremental session *******************/
+/* One compiler and one VM kept alive across inputs: every line is compiled against
+the symbols and constants of the lines before it and runs against the same globals.
+Only the new line is compiled, so latency does not grow with the session. */
+class Session {
+    public:
+    Compiler compiler;
+    VM vm;
+
+    Session(CompilerOptions options = CompilerOptions()) : compiler(incremental(options)), vm(ByteCode{}) {};
+
+    /* Later lines may rebind any global, so nothing may be assumed about a global
+    from the lines seen so far */
+    static CompilerOptions incremental(CompilerOptions options) {
+        options.incremental = true;
+        return options;
+    }
+
+    /* Compile and run one line. result is the value of its last expression, empty
+    if it has none, or a message on error. */
+    int eval(string input, string* result) {
+        *result = "";
+        Lexer l = Lexer(input);
+        Parser p = Parser(l);
+        auto program = Program();
+        if (p.parseProgram(&program)) {
+            *result = "error in parser...";
+            return 1;
+        }
+        compiler.inlineDecisions.clear();
+        if (compiler.compileProgram(&program)) {
+            compiler.dropByteCode();
+            *result = "error in compiler...";
+            return 1;
+        }
+        auto bytecode = compiler.takeByteCode();
+        int numGlobals = compiler.getSymbolTable().numDefs;
+        if (numGlobals > vm.globals.size()) vm.globals.resize(max(numGlobals, (int) vm.globals.size() * 2));
+        vm.load(move(bytecode));
+        if (vm.run()) {
+            *result = "error in vm...";
+            return 1;
+        }
+        if (!vm.getLastPopped().empty()) *result = vm.getLastPopped().serialize();
+        return 0;
+    }
+};
@@ -0,0 +1,101 @@
+#include"predecode.cpp"
+#include<cstdlib>
+#include<vector>
+
+using namespace std;
+
+/******************** slab allocator *******************/
+/* Blocks for small objects carved out of large slabs. Sizes are rounded up to a
+size class of slabGranularity bytes; every class has a free list, reused first,
+and a slab it bump allocates from once the list is empty. Slabs are only given
+back all at once, when the allocator goes away. Larger requests go to operator
+new. */
+const size_t slabGranularity = 16;
+const int slabClasses = 16; // blocks of up to 256 bytes
+const size_t slabSize = 64 << 10;
+
+struct SlabStats {
+    long long allocations = 0;
+    long long frees = 0;
+    long long largeAllocations = 0; // passed on to operator new
+    size_t bytesInUse = 0; // in handed out blocks, rounded up to their class
+    size_t bytesReserved = 0; // in slabs
+};
+
+class SlabAllocator {
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct SizeClass {
+        FreeBlock* freeList = nullptr;
+        char* next = nullptr; // bump pointer into the class's newest slab
+        char* end = nullptr;
+    };
+
+    SizeClass classes[slabClasses];
+    vector<char*> slabs;
+
+    public:
+    SlabStats stats;
+
+    SlabAllocator() = default;
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+    ~SlabAllocator() {
+        for (char* slab : slabs) free(slab);
+    }
+
+    static int sizeClass(size_t size) {
+        return (size + slabGranularity - 1) / slabGranularity - 1;
+    }
+
+    void* allocate(size_t size) {
+        int index = sizeClass(size);
+        if (index >= slabClasses) {
+            stats.largeAllocations++;
+            return ::operator new(size);
+        }
+        SizeClass& sc = classes[index];
+        size_t blockSize = (index + 1) * slabGranularity;
+        stats.allocations++;
+        stats.bytesInUse += blockSize;
+        if (sc.freeList != nullptr) {
+            FreeBlock* block = sc.freeList;
+            sc.freeList = block->next;
+            return block;
+        }
+        if (sc.next == nullptr || sc.next + blockSize > sc.end) {
+            char* slab = (char*) malloc(slabSize);
+            if (slab == nullptr) throw bad_alloc();
+            slabs.push_back(slab);
+            stats.bytesReserved += slabSize;
+            sc.next = slab;
+            sc.end = slab + slabSize;
+        }
+        void* block = sc.next;
+        sc.next += blockSize;
+        return block;
+    }
+
+    /* size must be the one the block was allocated with */
+    void deallocate(void* block, size_t size) {
+        int index = sizeClass(size);
+        if (index >= slabClasses) {
+            ::operator delete(block);
+            return;
+        }
+        SizeClass& sc = classes[index];
+        FreeBlock* freed = (FreeBlock*) block;
+        freed->next = sc.freeList;
+        sc.freeList = freed;
+        stats.frees++;
+        stats.bytesInUse -= (index + 1) * slabGranularity;
+    }
+
+    /* Share of the reserved slab bytes not in a handed out block */
+    double fragmentation() const {
+        if (stats.bytesReserved == 0) return 0;
+        return 1 - (double) stats.bytesInUse / stats.bytesReserved;
+    }
+};
@@ -0,0 +1,624 @@
+#include<algorithm>
+#include<functional>
+#include<map>
+#include<set>
+#include<vector>
+
+using namespace std;
+
+/******************** SSA form *******************/
+/* A function lifted from its stack bytecode into basic blocks of values that are
+each defined once. Stack slots live across a block boundary become phis at the
+start of the block; globals are read and written by explicit values. */
+struct SsaValue {
+    OpCode opcode;
+    int operand; // constant index, global or element count
+    vector<int> args;
+    int block;
+    bool phi = false; // stack slot on entry to its block
+    bool removed = false;
+    int replacedBy = -1;
+    SourcePos pos;
+};
+
+struct SsaBlock {
+    vector<int> values; // phis first, then in execution order
+    vector<int> preds;
+    OpCode exit = OpJump; // OpJump (also falling through), OpJumpIfFalse, OpLoop, OpRetVal or OpRet
+    int target = -1; // block jumped to, blocks.size() for the end of the code
+    int exitArg = -1; // condition of OpJumpIfFalse, value of OpRetVal
+    vector<int> exitStack; // stack handed to the successors, bottom first
+    SourcePos exitPos;
+};
+
+struct SsaFunction {
+    vector<SsaValue> values;
+    vector<SsaBlock> blocks;
+    bool main = false; // the last value popped by the main program is its result
+    bool hasCall = false;
+    set<int> written; // globals stored to
+};
+
+/* Temporary globals used to keep values that cannot stay on the stack. A callee
+may reuse them, so no value is kept in one across a call. */
+struct SsaTemps {
+    function<int(int)> global; // operand of temporary k
+    function<int(int)> number; // k of a global operand, -1 if it is not a temporary
+};
+
+bool producesValue(OpCode opcode) {
+    return opcode != OpSetGlobal && opcode != OpPop;
+}
+
+bool isConstantValue(OpCode opcode) {
+    return opcode == OpConstant || opcode == OpTrue || opcode == OpFalse || opcode == OpNull;
+}
+
+bool isBinaryValue(OpCode opcode) {
+    return opcode == OpAdd || opcode == OpSub || opcode == OpMul || opcode == OpDiv
+        || opcode == OpAddInt || opcode == OpSubInt || opcode == OpMulInt || opcode == OpDivInt
+        || opcode == OpEq || opcode == OpNeq || opcode == OpGt || opcode == OpIndex;
+}
+
+/* Same operands give the same result and nothing else happens (it may still fail) */
+bool isPureValue(OpCode opcode) {
+    return isConstantValue(opcode) || opcode == OpAdd || opcode == OpSub || opcode == OpMul || opcode == OpDiv
+        || opcode == OpAddInt || opcode == OpSubInt || opcode == OpMulInt || opcode == OpDivInt
+        || opcode == OpEq || opcode == OpNeq || opcode == OpGt || opcode == OpMinus || opcode == OpSurprise;
+}
+
+/* Cannot fail, so it can be dropped when nothing uses it */
+bool isRemovableValue(OpCode opcode) {
+    return isConstantValue(opcode) || opcode == OpGetGlobal || opcode == OpArray
+        || opcode == OpAddInt || opcode == OpSubInt || opcode == OpMulInt;
+}
+
+/* Reads a global that nothing in the function, or called by it, can change */
+bool isInvariantRead(SsaFunction& fn, int v) {
+    SsaValue& value = fn.values.at(v);
+    return value.opcode == OpGetGlobal && !value.phi && !fn.hasCall && fn.written.count(value.operand) == 0;
+}
+
+int addValue(SsaFunction& fn, int block, OpCode opcode, int operand, vector<int> args, SourcePos pos) {
+    SsaValue value;
+    value.opcode = opcode;
+    value.operand = operand;
+    value.args = args;
+    value.block = block;
+    value.pos = pos;
+    fn.values.push_back(value);
+    fn.blocks.at(block).values.push_back(fn.values.size() - 1);
+    return fn.values.size() - 1;
+}
+
+int popValue(vector<int>& stack) {
+    if (stack.empty()) return -1;
+    int v = stack.back();
+    stack.pop_back();
+    return v;
+}
+
+/* Returns 1 if the code is not in a shape the lifting understands */
+int buildSsa(const Instruction& instructions, bool main, SsaFunction* fn, const vector<SourcePos>* positions = nullptr) {
+    auto code = decodeInstructions(instructions, positions);
+    fn->main = main;
+    vector<bool> leader(code.size() + 1, false);
+    leader.at(0) = true;
+    for (int i = 0; i < code.size(); i++) {
+        if (isJump(code.at(i).opcode)) leader.at(code.at(i).target) = true;
+        if (isJump(code.at(i).opcode) || isTerminator(code.at(i).opcode)) leader.at(i + 1) = true;
+    }
+    vector<int> blockOf(code.size() + 1, 0);
+    vector<int> starts;
+    for (int i = 0; i < code.size(); i++) {
+        if (leader.at(i)) starts.push_back(i);
+        blockOf.at(i) = starts.size() - 1;
+    }
+    blockOf.at(code.size()) = starts.size();
+    fn->blocks = vector<SsaBlock>(starts.size());
+
+    // exits and predecessors
+    for (int b = 0; b < starts.size(); b++) {
+        int end = b + 1 < starts.size() ? starts.at(b + 1) : code.size();
+        auto& last = code.at(end - 1);
+        SsaBlock& block = fn->blocks.at(b);
+        block.target = b + 1;
+        if (isJump(last.opcode)) {
+            block.exit = last.opcode;
+            block.target = blockOf.at(last.target);
+        } else if (last.opcode == OpRetVal || last.opcode == OpRet) {
+            block.exit = last.opcode;
+            block.target = -1;
+        }
+        if (block.target >= 0 && block.target < starts.size()) fn->blocks.at(block.target).preds.push_back(b);
+        if (block.exit == OpJumpIfFalse && b + 1 < starts.size()) fn->blocks.at(b + 1).preds.push_back(b);
+    }
+
+    // lift blocks in layout order; only loops jump backwards, to a block already reached by falling in
+    vector<int> depth(starts.size(), -1);
+    depth.at(0) = 0;
+    for (int b = 0; b < starts.size(); b++) {
+        if (depth.at(b) < 0) return 1; // unreachable block
+        vector<int> stack;
+        for (int s = 0; s < depth.at(b); s++) {
+            int phi = addValue(*fn, b, OpWide, s, vector<int>{}, code.at(starts.at(b)).pos); // operand is the stack slot
+            fn->values.at(phi).phi = true;
+            stack.push_back(phi);
+        }
+        int end = b + 1 < starts.size() ? starts.at(b + 1) : code.size();
+        SsaBlock& block = fn->blocks.at(b);
+        for (int i = starts.at(b); i < end; i++) {
+            auto& ins = code.at(i);
+            OpCode op = ins.opcode;
+            int operand = ins.operands.empty() ? 0 : ins.operands.at(0);
+            SourcePos pos = ins.pos;
+            if (isConstantValue(op) || op == OpGetGlobal) {
+                stack.push_back(addValue(*fn, b, op, operand, vector<int>{}, pos));
+            } else if (op == OpSetGlobal || op == OpPop) {
+                int v = popValue(stack);
+                if (v < 0) return 1;
+                addValue(*fn, b, op, operand, vector<int>{v}, pos);
+                if (op == OpSetGlobal) fn->written.insert(operand);
+            } else if (op == OpMinus || op == OpSurprise || op == OpCall) {
+                int v = popValue(stack);
+                if (v < 0) return 1;
+                stack.push_back(addValue(*fn, b, op, operand, vector<int>{v}, pos));
+                if (op == OpCall) fn->hasCall = true;
+            } else if (op == OpArray || op == OpHash) {
+                if (operand > stack.size()) return 1;
+                vector<int> args(stack.end() - operand, stack.end());
+                stack.resize(stack.size() - operand);
+                stack.push_back(addValue(*fn, b, op, operand, args, pos));
+            } else if (op == OpJumpIfFalse || op == OpRetVal) {
+                block.exitArg = popValue(stack);
+                block.exitPos = pos;
+                if (block.exitArg < 0) return 1;
+            } else if (op == OpJump || op == OpLoop || op == OpRet) {
+                block.exitPos = pos;
+            } else if (isBinaryValue(op)) {
+                int right = popValue(stack);
+                int left = popValue(stack);
+                if (left < 0 || right < 0) return 1;
+                stack.push_back(addValue(*fn, b, op, operand, vector<int>{left, right}, pos));
+            } else {
+                return 1; // unknown instruction
+            }
+        }
+        block.exitStack = stack;
+        vector<int> succs;
+        if (block.target >= 0 && block.target < starts.size()) succs.push_back(block.target);
+        if (block.exit == OpJumpIfFalse && b + 1 < starts.size()) succs.push_back(b + 1);
+        for (int succ : succs) {
+            if (depth.at(succ) >= 0 && depth.at(succ) != stack.size()) return 1; // stack depths disagree
+            depth.at(succ) = stack.size();
+        }
+    }
+    return 0;
+}
+
+int resolveValue(SsaFunction& fn, int v) {
+    while (fn.values.at(v).replacedBy >= 0) v = fn.values.at(v).replacedBy;
+    return v;
+}
+
+void replaceValue(SsaFunction& fn, int v, int with) {
+    fn.values.at(v).replacedBy = with;
+    fn.values.at(v).removed = true;
+}
+
+/* Point every use at the value that replaced it */
+void applyReplacements(SsaFunction& fn) {
+    for (auto& value : fn.values) {
+        for (int& arg : value.args) arg = resolveValue(fn, arg);
+    }
+    for (auto& block : fn.blocks) {
+        if (block.exitArg >= 0) block.exitArg = resolveValue(fn, block.exitArg);
+        for (int& v : block.exitStack) v = resolveValue(fn, v);
+    }
+}
+
+/* Reading a global gives the value last stored to it, or last read from it, in the
+same block unless a call came in between */
+bool propagateCopies(SsaFunction& fn) {
+    bool changed = false;
+    for (auto& block : fn.blocks) {
+        map<int, int> known;
+        for (int v : block.values) {
+            SsaValue& value = fn.values.at(v);
+            if (value.removed) continue;
+            if (value.opcode == OpSetGlobal) {
+                known[value.operand] = resolveValue(fn, value.args.at(0));
+            } else if (value.opcode == OpGetGlobal) {
+                if (known.count(value.operand)) {
+                    replaceValue(fn, v, known.at(value.operand));
+                    changed = true;
+                } else {
+                    known[value.operand] = v;
+                }
+            } else if (value.opcode == OpCall) {
+                known.clear();
+            }
+        }
+    }
+    return changed;
+}
+
+/* leaders maps values to an equal value that was not worth replacing them with */
+vector<int> valueKey(SsaFunction& fn, int v, const map<int, int>& leaders = {}) {
+    SsaValue& value = fn.values.at(v);
+    vector<int> args;
+    for (int arg : value.args) {
+        int a = resolveValue(fn, arg);
+        args.push_back(leaders.count(a) ? leaders.at(a) : a);
+    }
+    OpCode op = value.opcode;
+    if (op == OpAddInt || op == OpMulInt || op == OpEq || op == OpNeq) sort(args.begin(), args.end());
+    vector<int> key = {(int) op, value.operand};
+    key.insert(key.end(), args.begin(), args.end());
+    return key;
+}
+
+/* Pure values computed twice in a block are computed once */
+bool eliminateCommonSubexpressions(SsaFunction& fn) {
+    bool changed = false;
+    for (auto& block : fn.blocks) {
+        map<vector<int>, int> seen;
+        for (int v : block.values) {
+            SsaValue& value = fn.values.at(v);
+            if (value.removed || value.phi || !(isPureValue(value.opcode) || isInvariantRead(fn, v))) continue;
+            auto key = valueKey(fn, v);
+            if (seen.count(key)) {
+                replaceValue(fn, v, seen.at(key));
+                changed = true;
+            } else {
+                seen[key] = v;
+            }
+        }
+    }
+    return changed;
+}
+
+/* Instructions needed to recompute v from values of other blocks */
+int treeSize(SsaFunction& fn, int v) {
+    SsaValue& value = fn.values.at(v);
+    int size = 1;
+    for (int arg : value.args) {
+        int a = resolveValue(fn, arg);
+        size += fn.values.at(a).block == value.block && !fn.values.at(a).phi ? treeSize(fn, a) : 1;
+    }
+    return size;
+}
+
+vector<int> immediateDominators(SsaFunction& fn) {
+    int n = fn.blocks.size();
+    vector<int> idom(n, -1);
+    idom.at(0) = 0;
+    // blocks are in layout order, so every forward predecessor comes first
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (a > b) a = idom.at(a);
+            while (b > a) b = idom.at(b);
+        }
+        return a;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int b = 1; b < n; b++) {
+            int dom = -1;
+            for (int pred : fn.blocks.at(b).preds) {
+                if (idom.at(pred) < 0) continue;
+                dom = dom < 0 ? pred : intersect(pred, dom);
+            }
+            if (dom != idom.at(b)) {
+                idom.at(b) = dom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+/* Pure values already computed in a dominating block are reused. The value then
+lives across blocks in a temporary, so only do it where that is cheaper than
+recomputing and no call can reuse the temporary. Constants and invariant reads
+are reloaded where they are used, which also lets larger trees built on them match. */
+bool numberGlobalValues(SsaFunction& fn) {
+    if (fn.hasCall) return false;
+    auto idom = immediateDominators(fn);
+    map<vector<int>, int> available; // key -> value, for the dominators of the current block
+    map<int, int> leaders;
+    vector<vector<int>> children(fn.blocks.size());
+    for (int b = 1; b < fn.blocks.size(); b++) {
+        if (idom.at(b) >= 0) children.at(idom.at(b)).push_back(b);
+    }
+    bool changed = false;
+    function<void(int)> visit = [&](int b) {
+        vector<vector<int>> added;
+        for (int v : fn.blocks.at(b).values) {
+            SsaValue& value = fn.values.at(v);
+            if (value.removed || value.phi || !(isPureValue(value.opcode) || isInvariantRead(fn, v))) continue;
+            auto key = valueKey(fn, v, leaders);
+            if (available.count(key)) {
+                int other = available.at(key);
+                if (isConstantValue(value.opcode) || isInvariantRead(fn, v) || treeSize(fn, v) >= 4) {
+                    replaceValue(fn, v, other);
+                    changed = true;
+                } else {
+                    leaders[v] = other; // larger values built on it can still match
+                }
+                continue;
+            }
+            available[key] = v;
+            added.push_back(key);
+        }
+        for (int child : children.at(b)) visit(child);
+        for (auto& key : added) available.erase(key);
+    };
+    visit(0);
+    return changed;
+}
+
+/* Remove values nothing uses and that cannot fail, and popped values that are
+only computed to be popped. The main program keeps the pop that may be its last. */
+bool eliminateDeadValues(SsaFunction& fn) {
+    applyReplacements(fn);
+    vector<int> uses(fn.values.size(), 0);
+    for (auto& value : fn.values) {
+        if (value.removed) continue;
+        for (int arg : value.args) uses.at(arg)++;
+    }
+    for (auto& block : fn.blocks) {
+        if (block.exitArg >= 0) uses.at(block.exitArg)++;
+        for (int v : block.exitStack) uses.at(v)++;
+    }
+    bool changed = false;
+    function<void(int)> kill = [&](int v) {
+        fn.values.at(v).removed = true;
+        changed = true;
+        for (int arg : fn.values.at(v).args) {
+            SsaValue& argValue = fn.values.at(arg);
+            if (--uses.at(arg) == 0 && !argValue.removed && !argValue.phi && isRemovableValue(argValue.opcode)) kill(arg);
+        }
+    };
+    for (auto& block : fn.blocks) {
+        bool pushLater = false;
+        for (int i = block.values.size() - 1; i >= 0; i--) {
+            int v = block.values.at(i);
+            SsaValue& value = fn.values.at(v);
+            if (value.removed || value.phi) continue;
+            if (value.opcode == OpPop) {
+                SsaValue& popped = fn.values.at(value.args.at(0));
+                bool dead = uses.at(value.args.at(0)) == 1 && !popped.phi && isRemovableValue(popped.opcode);
+                if (dead && (!fn.main || pushLater)) kill(v);
+            } else if (producesValue(value.opcode) && uses.at(v) == 0 && isRemovableValue(value.opcode)) {
+                kill(v);
+            }
+            if (!fn.values.at(v).removed && producesValue(value.opcode)) pushLater = true;
+        }
+    }
+    return changed;
+}
+
+/******************** lowering *******************/
+const int StackValue = 0; // pushed where defined and consumed from the top of the stack
+const int RematValue = 1; // not emitted where defined; recomputed where used
+const int SpillValue = 2; // stored to a temporary where defined and read from it where used
+
+struct SsaLowering {
+    SsaFunction& fn;
+    vector<int> mode;
+    map<int, int> spillTemp; // value -> temporary number
+    int nextTemp;
+    vector<OptInstruction> code;
+    vector<int> blockStart;
+    vector<pair<int, int>> jumps; // instruction index, target block
+    // state of the block being lowered
+    vector<int> stack;
+    map<int, int> homes; // global or temporary -> value it holds
+    map<int, int> writes; // global -> number of stores to it in this block
+    int calls;
+    map<int, pair<int, int>> rematVersion; // remat global read -> (writes, calls) where it was defined
+
+    SsaLowering(SsaFunction& fn, int firstTemp) : fn(fn), mode(fn.values.size(), StackValue), nextTemp(firstTemp) {};
+
+    int tempOperand(int v) {
+        if (spillTemp.count(v) == 0) spillTemp[v] = nextTemp++;
+        return -1 - spillTemp.at(v); // replaced by the real operand once lowering succeeds
+    }
+
+    void emit(OpCode opcode, vector<int> operands, SourcePos pos) {
+        code.push_back(OptInstruction{opcode, operands, -1, false, pos});
+    }
+
+    /* Push v from somewhere other than the stack; returns false if it is not available */
+    bool load(int v, int block) {
+        SsaValue& value = fn.values.at(v);
+        if (!value.phi && isConstantValue(value.opcode)) {
+            emit(value.opcode, defs[value.opcode].operandCount ? vector<int>{value.operand} : vector<int>{}, value.pos);
+            return true;
+        }
+        if (mode.at(v) == RematValue && isInvariantRead(fn, v)) {
+            emit(OpGetGlobal, vector<int>{value.operand}, value.pos);
+            return true;
+        }
+        if (mode.at(v) == RematValue && value.block == block && rematVersion.count(v)) {
+            auto version = rematVersion.at(v);
+            if (version.first == writes[value.operand] && version.second == calls) {
+                emit(OpGetGlobal, vector<int>{value.operand}, value.pos);
+                return true;
+            }
+        }
+        for (auto& home : homes) {
+            if (home.second != v) continue;
+            emit(OpGetGlobal, vector<int>{home.first}, value.pos);
+            return true;
+        }
+        if (mode.at(v) == SpillValue && value.block != block && !fn.hasCall) {
+            emit(OpGetGlobal, vector<int>{tempOperand(v)}, value.pos);
+            return true;
+        }
+        return false;
+    }
+
+    /* Arrange for args to be on top of the stack, in order, taking the longest
+    run already there. Returns the value in the way, or -1. */
+    int arrange(vector<int> args, int block, bool exact) {
+        int m = min(args.size(), stack.size());
+        if (exact) {
+            // leaving the block: the whole stack has to be the start of args
+            for (int i = 0; i < stack.size(); i++) {
+                if (i >= args.size() || stack.at(i) != args.at(i)) return stack.at(i);
+            }
+            m = stack.size();
+        } else {
+            while (m > 0 && !equal(stack.end() - m, stack.end(), args.begin())) m--;
+        }
+        stack.resize(stack.size() - m);
+        for (int i = m; i < args.size(); i++) {
+            if (!load(args.at(i), block)) return args.at(i);
+        }
+        return -1;
+    }
+
+    int lowerBlock(int b) {
+        SsaBlock& block = fn.blocks.at(b);
+        stack.clear();
+        homes.clear();
+        writes.clear();
+        calls = 0;
+        blockStart.at(b) = code.size();
+        int phis = 0;
+        while (phis < block.values.size() && fn.values.at(block.values.at(phis)).phi) phis++;
+        for (int i = 0; i < phis; i++) stack.push_back(block.values.at(i));
+        // spilled phis are stored from the top down
+        for (int i = phis - 1; i >= 0; i--) {
+            int v = block.values.at(i);
+            if (mode.at(v) != SpillValue) break;
+            emit(OpSetGlobal, vector<int>{tempOperand(v)}, fn.values.at(v).pos);
+            homes[tempOperand(v)] = v;
+            stack.pop_back();
+        }
+        for (int i = 0; i < stack.size(); i++) {
+            if (mode.at(stack.at(i)) == SpillValue) return stack.at(stack.size() - 1); // phis above a spilled one must spill too
+        }
+
+        for (int i = phis; i < block.values.size(); i++) {
+            int v = block.values.at(i);
+            SsaValue& value = fn.values.at(v);
+            if (value.removed) continue;
+            if (mode.at(v) == RematValue) {
+                if (value.opcode == OpGetGlobal) rematVersion[v] = make_pair(writes[value.operand], calls);
+                continue;
+            }
+            int culprit = arrange(value.args, b, false);
+            if (culprit >= 0) return culprit;
+            emit(value.opcode, defs[value.opcode].operandCount ? vector<int>{value.operand} : vector<int>{}, value.pos);
+            if (value.opcode == OpSetGlobal) {
+                writes[value.operand]++;
+                homes[value.operand] = value.args.at(0);
+            } else if (value.opcode == OpGetGlobal) {
+                homes[value.operand] = v;
+            } else if (value.opcode == OpCall) {
+                calls++;
+                homes.clear();
+            }
+            if (!producesValue(value.opcode)) continue;
+            if (mode.at(v) == SpillValue) {
+                emit(OpSetGlobal, vector<int>{tempOperand(v)}, value.pos);
+                homes[tempOperand(v)] = v;
+            } else {
+                stack.push_back(v);
+            }
+        }
+
+        vector<int> exitArgs = block.exitStack;
+        if (block.exitArg >= 0) exitArgs.push_back(block.exitArg);
+        int culprit = arrange(exitArgs, b, true);
+        if (culprit >= 0) return culprit;
+        if (block.exit == OpRetVal || block.exit == OpRet) {
+            emit(block.exit, vector<int>{}, block.exitPos);
+        } else {
+            jumps.push_back(make_pair(code.size(), block.target));
+            emit(block.exit, vector<int>{0}, block.exitPos);
+        }
+        return -1;
+    }
+
+    /* Returns the value whose placement has to change, -1 once lowered */
+    int lower() {
+        code.clear();
+        jumps.clear();
+        blockStart = vector<int>(fn.blocks.size() + 1, 0);
+        for (int b = 0; b < fn.blocks.size(); b++) {
+            int culprit = lowerBlock(b);
+            if (culprit >= 0) return culprit;
+        }
+        blockStart.at(fn.blocks.size()) = code.size();
+        for (auto& jump : jumps) code.at(jump.first).target = blockStart.at(jump.second);
+        return -1;
+    }
+};
+
+/* Lower back to bytecode, moving values off the stack until every use can be met */
+int lowerSsa(SsaFunction& fn, int firstTemp, vector<OptInstruction>* res) {
+    SsaLowering lowering(fn, firstTemp);
+    for (int attempt = 0; attempt <= 2 * fn.values.size() + 1; attempt++) {
+        int culprit = lowering.lower();
+        if (culprit < 0) {
+            *res = lowering.code;
+            return 0;
+        }
+        int& mode = lowering.mode.at(culprit);
+        SsaValue& value = fn.values.at(culprit);
+        bool remat = !value.phi && (isConstantValue(value.opcode) || value.opcode == OpGetGlobal);
+        if (mode == StackValue && remat) mode = RematValue;
+        else if (mode != SpillValue) mode = SpillValue;
+        else return 1; // spilling did not help
+        if (value.phi) {
+            // phis are spilled from the top of the entry stack down
+            for (int v : fn.blocks.at(value.block).values) {
+                if (fn.values.at(v).phi && fn.values.at(v).operand > value.operand) lowering.mode.at(v) = SpillValue;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Copy propagation, common subexpression elimination, global value numbering and
+dead value elimination on the SSA form of a function. The result is only used if it
+executes in fewer instructions; counts rather than bytes, so that operand widths
+cannot change the decision. positions, if given, is updated to match. */
+Instruction optimizeSsa(const Instruction& instructions, bool main, SsaTemps& temps, vector<SourcePos>* positions = nullptr) {
+    SsaFunction fn;
+    if (instructions.empty() || buildSsa(instructions, main, &fn, positions)) return instructions;
+    bool changed = true;
+    while (changed) {
+        changed = propagateCopies(fn);
+        changed |= eliminateCommonSubexpressions(fn);
+        changed |= numberGlobalValues(fn);
+        changed |= eliminateDeadValues(fn);
+    }
+    applyReplacements(fn);
+
+    int firstTemp = 0;
+    auto original = decodeInstructions(instructions);
+    for (auto& ins : original) {
+        if (ins.opcode == OpGetGlobal || ins.opcode == OpSetGlobal) firstTemp = max(firstTemp, temps.number(ins.operands.at(0)) + 1);
+    }
+    vector<OptInstruction> code;
+    if (lowerSsa(fn, firstTemp, &code)) return instructions;
+    // temporaries are only allocated for a result that is kept
+    auto placeholders = code;
+    for (auto& ins : placeholders) {
+        if ((ins.opcode == OpGetGlobal || ins.opcode == OpSetGlobal) && ins.operands.at(0) < 0) ins.operands.at(0) = 0;
+    }
+    if (decodeInstructions(eliminateDeadCode(encodeInstructions(placeholders))).size() >= original.size()) return instructions;
+    for (auto& ins : code) {
+        if ((ins.opcode == OpGetGlobal || ins.opcode == OpSetGlobal) && ins.operands.at(0) < 0) {
+            ins.operands.at(0) = temps.global(-1 - ins.operands.at(0));
+        }
+    }
+    auto res = encodeInstructions(code, positions);
+    return eliminateDeadCode(res, positions);
+}
@@ -27,7 +27,7 @@ class SymbolTable {
     }
 
     unique_ptr<Symbol>& define(string name) {
-        if (store.count(name) > 0) {
+        if (store.count(name) > 0 && store[name] != nullptr) { // resolve leaves null entries for unknown names
             int index = store[name].get()->index;
             store[name] = make_unique<Symbol>(name, GlobalScope, index);
         } else {
@@ -37,6 +37,13 @@ class SymbolTable {
         return store[name];
     }
 
+    /* Define name at a known index, e.g. when loading a precompiled image */
+    unique_ptr<Symbol>& defineAt(string name, int index) {
+        store[name] = make_unique<Symbol>(name, GlobalScope, index);
+        numDefs = max(numDefs, index + 1);
+        return store[name];
+    }
+
     unique_ptr<Symbol>& resolve(string name) {
         return store[name];
     }
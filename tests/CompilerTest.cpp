@@ -11,7 +11,10 @@ TEST(CompilerTest, ValueTest) {
         vector<byte> expected;
     };
     vector<Test> tests = {
-        {OpConstant, vector<int>{65534}, vector<byte>{OpConstant, (byte) 0, (byte) 0, (byte) 255, (byte)254}},
+        {OpConstant, vector<int>{254}, vector<byte>{OpConstant, (byte) 254}},
+        {OpConstant, vector<int>{65534}, vector<byte>{OpWide, OpConstant, (byte) 255, (byte)254}},
+        {OpConstant, vector<int>{65536}, vector<byte>{OpWide, OpWide, OpConstant, (byte) 0, (byte) 1, (byte) 0, (byte) 0}},
+        {OpJump, vector<int>{-3}, vector<byte>{OpJump, (byte) 255, (byte) 253}},
         {OpAdd, vector<int>{}, vector<byte>{OpAdd}}
     };
     for (Test test : tests) {
@@ -62,19 +65,43 @@ TEST(CompilerTest, ReadOperandsTest) {
     };
 
     vector<Test> tests = {
-        {OpConstant, vector<int>{65535}}
+        {OpConstant, vector<int>{255}},
+        {OpConstant, vector<int>{65535}},
+        {OpConstant, vector<int>{1 << 20}},
+        {OpJumpIfFalse, vector<int>{-40000}}
     };
 
     for (auto test : tests) {
         auto instruction = constructByteCode(test.opcode, test.operands);
         if (lookup(test.opcode)) FAIL() << "Opcode does not exist..." << endl;
-        vector<int> operandsRead = destructOperandsByteCode(defs[test.opcode], instruction, 1).first;
-        for (int i = 0; i < operandsRead.size(); i++) {
-            ASSERT_EQ(operandsRead.at(i), test.operands.at(i));
+        int wide = 0;
+        while (instruction.at(wide) == OpWide) wide++;
+        auto operandsRead = destructOperandsByteCode(defs[test.opcode], instruction, wide + 1, wide);
+        ASSERT_EQ(instructionLength(instruction, 0), instruction.size());
+        ASSERT_EQ(wide + 1 + operandsRead.second, instruction.size());
+        for (int i = 0; i < operandsRead.first.size(); i++) {
+            ASSERT_EQ(operandsRead.first.at(i), test.operands.at(i));
         }
     }
 }
 
+TEST(CompilerTest, OpcodeTableTest) {
+    ASSERT_EQ(string(defs[OpConstant].name), "OpConstant");
+    ASSERT_EQ(string(defs[OpDivInt].name), "OpDivInt");
+    ASSERT_EQ((int) OpLoop, 25); // numbers are part of the image format
+    ASSERT_EQ(lookup(OpDivInt), 0);
+    ASSERT_EQ(lookup((byte) numOpCodes), 1);
+    ASSERT_EQ(instructionLength(Instruction{(byte) numOpCodes}, 0), 0);
+    static_assert(defs[OpJump].relative && defs[OpJump].operandWidth == 2, "jumps take a 2 byte offset");
+    static_assert(defs[OpAdd].pops == 2 && defs[OpAdd].pushes == 1, "binary operators");
+    static_assert(defs[OpArray].pops == -1, "element count comes from the operand");
+    for (int op = 0; op < numOpCodes; op++) {
+        const Definition& def = defs[(OpCode) op];
+        vector<int> operands(def.operandCount, 1);
+        ASSERT_EQ(constructByteCode((OpCode) op, operands).size(), 1 + def.operandCount * def.operandWidth) << def.name;
+    }
+}
+
 TEST(CompilerTest, InstructionSerializeTest) {
     vector<Instruction> instructions = {
         constructByteCode(OpAdd, vector<int>{}),
@@ -82,12 +109,48 @@ TEST(CompilerTest, InstructionSerializeTest) {
         constructByteCode(OpConstant, vector<int>{2}),
         constructByteCode(OpConstant, vector<int>{65534})
     };
-    string expected = "0000 OpAdd\n0001 OpConstant 1\n0006 OpConstant 2\n0011 OpConstant 65534";
+    string expected = "0000 OpAdd\n0001 OpConstant 1\n0003 OpConstant 2\n0005 OpWide OpConstant 65534";
     Instruction concat = concatInstructions(instructions);
 
     ASSERT_EQ(serialize(concat), expected);
 }
 
+TEST(CompilerTest, InstructionIteratorTest) {
+    Instruction code = concatInstructions(vector<Instruction>{
+        constructByteCode(OpConstant, vector<int>{65534}),
+        constructByteCode(OpJumpIfFalse, vector<int>{-3}),
+        constructByteCode(OpPop, vector<int>{})
+    });
+    vector<int> offsets, lengths, operands;
+    for (auto& ins : InstructionRange(code)) {
+        ASSERT_TRUE(ins.valid);
+        offsets.push_back(ins.offset);
+        lengths.push_back(ins.length);
+        if (ins.operandCount > 0) operands.push_back(ins.operands[0]);
+    }
+    ASSERT_EQ(offsets, (vector<int>{0, 4, 7}));
+    ASSERT_EQ(lengths, (vector<int>{4, 3, 1}));
+    ASSERT_EQ(operands, (vector<int>{65534, -3}));
+
+    ostringstream out;
+    ASSERT_EQ(disassemble(out, InstructionRange(code)), 0);
+    ASSERT_EQ(out.str(), serialize(code));
+
+    // truncated operand, then an unknown opcode
+    Instruction truncated = {OpPop, OpJump, (byte) 1};
+    ostringstream truncatedOut;
+    ASSERT_EQ(disassemble(truncatedOut, InstructionRange(truncated)), 1);
+    ASSERT_EQ(truncatedOut.str(), "0000 OpPop\n0001 invalid");
+    Instruction unknown = {OpWide, (byte) numOpCodes, OpPop};
+    int count = 0;
+    for (auto& ins : InstructionRange(unknown)) {
+        ASSERT_FALSE(ins.valid);
+        ASSERT_EQ(ins.length, 3);
+        count++;
+    }
+    ASSERT_EQ(count, 1);
+}
+
 TEST(CompilerTest, ArithmeticTest) {
     string input = "1 + 2";
     Lexer l = Lexer(input);
@@ -104,7 +167,7 @@ TEST(CompilerTest, ArithmeticTest) {
     vector<Instruction> expected = {
         constructByteCode(OpConstant, vector<int>{0}),
         constructByteCode(OpConstant, vector<int>{1}),
-        constructByteCode(OpAdd, vector<int>{}),
+        constructByteCode(OpAddInt, vector<int>{}),
         constructByteCode(OpPop, vector<int>{})
     };
     testInstructions(concatInstructions(expected), bytecode.instructions);
@@ -171,24 +234,24 @@ TEST(CompilerTest, ComparisonTest) {
     auto bytecode = compiler.getByteCode();
     vector<Instruction> expected = {
         constructByteCode(OpConstant, vector<int>{0}),
-        constructByteCode(OpConstant, vector<int>{1}),
+        constructByteCode(OpConstant, vector<int>{0}),
         constructByteCode(OpEq, vector<int>{}),
         constructByteCode(OpPop, vector<int>{}),
+        constructByteCode(OpConstant, vector<int>{1}),
         constructByteCode(OpConstant, vector<int>{2}),
-        constructByteCode(OpConstant, vector<int>{3}),
         constructByteCode(OpNeq, vector<int>{}),
         constructByteCode(OpPop, vector<int>{}),
-        constructByteCode(OpConstant, vector<int>{4}),
-        constructByteCode(OpConstant, vector<int>{5}),
+        constructByteCode(OpConstant, vector<int>{2}),
+        constructByteCode(OpConstant, vector<int>{1}),
         constructByteCode(OpGt, vector<int>{}),
         constructByteCode(OpPop, vector<int>{}),
-        constructByteCode(OpConstant, vector<int>{6}),
-        constructByteCode(OpConstant, vector<int>{7}),
+        constructByteCode(OpConstant, vector<int>{2}),
+        constructByteCode(OpConstant, vector<int>{1}),
         constructByteCode(OpGt, vector<int>{}),
         constructByteCode(OpPop, vector<int>{}),
     };
     testInstructions(concatInstructions(expected), bytecode.instructions);
-    testConstants(vector<int>{1, 1, 2, 3, 3, 2, 3, 2}, move(bytecode.constants));
+    testConstants(vector<int>{1, 2, 3}, move(bytecode.constants)); // small integers share a constant
 }
 
 TEST(CompilerTest, PrefixTest) {
@@ -228,15 +291,10 @@ TEST(CompilerTest, ConditionalNullTest) {
     if (err) FAIL() << "test failed due to error in compiler..." << endl;
 
     auto bytecode = compiler.getByteCode();
+    // the constant-false branch and its OpNull fallback are eliminated
     vector<Instruction> expected = {
-        constructByteCode(OpFalse, vector<int>{}), // 0000
-        constructByteCode(OpJumpIfFalse, vector<int>{16}), // 0001
-        constructByteCode(OpConstant, vector<int>{0}), // 0006
-        constructByteCode(OpJump, vector<int>{17}), // 0011
-        constructByteCode(OpNull, vector<int>{}), // 0016
-        constructByteCode(OpPop, vector<int>{}), //0017
-        constructByteCode(OpConstant, vector<int>{1}), //0018
-        constructByteCode(OpPop, vector<int>{}) // 0023
+        constructByteCode(OpConstant, vector<int>{1}),
+        constructByteCode(OpPop, vector<int>{})
     };
     testInstructions(concatInstructions(expected), bytecode.instructions);
     testConstants(vector<int>{1, 2}, move(bytecode.constants));
@@ -255,21 +313,137 @@ TEST(CompilerTest, IfElseTest) {
     if (err) FAIL() << "test failed due to error in compiler..." << endl;
 
     auto bytecode = compiler.getByteCode();
+    // only the taken arm of a constant condition survives
     vector<Instruction> expected = {
-        constructByteCode(OpTrue, vector<int>{}), // 0000
-        constructByteCode(OpJumpIfFalse, vector<int>{16}), // 0001
-        constructByteCode(OpConstant, vector<int>{0}), // 0006
-        constructByteCode(OpJump, vector<int>{21}), // 0011
-        constructByteCode(OpConstant, vector<int>{1}), // 0016
-        constructByteCode(OpPop, vector<int>{}), //0021
-        constructByteCode(OpConstant, vector<int>{2}), //0022
-        constructByteCode(OpPop, vector<int>{}) // 0027
+        constructByteCode(OpConstant, vector<int>{0}),
+        constructByteCode(OpPop, vector<int>{}),
+        constructByteCode(OpConstant, vector<int>{2}),
+        constructByteCode(OpPop, vector<int>{})
     };
-    // cout << serialize(bytecode.instructions) << endl;
     testInstructions(concatInstructions(expected), bytecode.instructions);
     testConstants(vector<int>{1, 2, 3}, move(bytecode.constants));
 }
 
+TEST(CompilerTest, ConditionalDiscardTest) {
+    string input = "let x = true; if (x) {1}; 2;";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+    
+    auto compiler = Compiler();
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+    auto bytecode = compiler.getByteCode();
+    // the value of the if is unused, so there is no OpNull fallback
+    vector<Instruction> expected = {
+        constructByteCode(OpTrue, vector<int>{}), // 0000
+        constructByteCode(OpSetGlobal, vector<int>{0}), // 0001
+        constructByteCode(OpGetGlobal, vector<int>{0}), // 0003
+        constructByteCode(OpJumpIfFalse, vector<int>{3}), // 0005
+        constructByteCode(OpConstant, vector<int>{0}), // 0008
+        constructByteCode(OpPop, vector<int>{}), // 0010
+        constructByteCode(OpConstant, vector<int>{1}), // 0011
+        constructByteCode(OpPop, vector<int>{}) // 0013
+    };
+    testInstructions(concatInstructions(expected), bytecode.instructions);
+    testConstants(vector<int>{1, 2}, move(bytecode.constants));
+}
+
+TEST(CompilerTest, ConditionalValueTest) {
+    string input = "let x = true; let y = if (x) {1} else {2};";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+    
+    auto compiler = Compiler();
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+    auto bytecode = compiler.getByteCode();
+    vector<Instruction> expected = {
+        constructByteCode(OpTrue, vector<int>{}), // 0000
+        constructByteCode(OpSetGlobal, vector<int>{0}), // 0001
+        constructByteCode(OpGetGlobal, vector<int>{0}), // 0003
+        constructByteCode(OpJumpIfFalse, vector<int>{5}), // 0005
+        constructByteCode(OpConstant, vector<int>{0}), // 0008
+        constructByteCode(OpJump, vector<int>{2}), // 0010
+        constructByteCode(OpConstant, vector<int>{1}), // 0013
+        constructByteCode(OpSetGlobal, vector<int>{1}) // 0015
+    };
+    testInstructions(concatInstructions(expected), bytecode.instructions);
+    testConstants(vector<int>{1, 2}, move(bytecode.constants));
+}
+
+TEST(CompilerTest, DeadCodeTest) {
+    string input = "fn(){return 1; 2;}; fn(){if (false) {return 3;} else {return 4;}};";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+    
+    auto compiler = Compiler();
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+    auto bytecode = compiler.getByteCode();
+    // statements after return are not compiled, so 2 never becomes a constant
+    vector<Instruction> expected = {
+        constructByteCode(OpConstant, vector<int>{1}),
+        constructByteCode(OpPop, vector<int>{}),
+        constructByteCode(OpConstant, vector<int>{4}),
+        constructByteCode(OpPop, vector<int>{})
+    };
+    testInstructions(concatInstructions(expected), bytecode.instructions);
+    vector<Instruction> expectedFirst = {
+        constructByteCode(OpConstant, vector<int>{0}),
+        constructByteCode(OpRetVal, vector<int>{})
+    };
+    CompiledFunction* first = dynamic_cast<CompiledFunction*>(bytecode.constants.at(1).get());
+    testInstructions(concatInstructions(expectedFirst), first->instructions);
+    vector<Instruction> expectedSecond = {
+        constructByteCode(OpConstant, vector<int>{3}),
+        constructByteCode(OpRetVal, vector<int>{})
+    };
+    CompiledFunction* second = dynamic_cast<CompiledFunction*>(bytecode.constants.at(4).get());
+    testInstructions(concatInstructions(expectedSecond), second->instructions);
+}
+
+TEST(CompilerTest, WhileTest) {
+    string input = "let i = 0; while (i < 3) { let i = i + 1; }";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+    
+    auto compiler = Compiler();
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+    auto bytecode = compiler.getByteCode();
+    vector<Instruction> expected = {
+        constructByteCode(OpConstant, vector<int>{0}), // 0000
+        constructByteCode(OpSetGlobal, vector<int>{0}), // 0002
+        constructByteCode(OpConstant, vector<int>{1}), // 0004
+        constructByteCode(OpGetGlobal, vector<int>{0}), // 0006
+        constructByteCode(OpGt, vector<int>{}), // 0008
+        constructByteCode(OpJumpIfFalse, vector<int>{10}), // 0009
+        constructByteCode(OpGetGlobal, vector<int>{0}), // 0012
+        constructByteCode(OpConstant, vector<int>{2}), // 0014
+        constructByteCode(OpAddInt, vector<int>{}), // 0016
+        constructByteCode(OpSetGlobal, vector<int>{0}), // 0017
+        constructByteCode(OpLoop, vector<int>{-18}) // 0019
+    };
+    testInstructions(concatInstructions(expected), bytecode.instructions);
+    testConstants(vector<int>{0, 3, 1}, move(bytecode.constants));
+}
+
 TEST(CompilerTest, LetTest) {
     string input = "let one = 4; let two = 5; let two = one; one;";
     Lexer l = Lexer(input);
@@ -298,6 +472,53 @@ TEST(CompilerTest, LetTest) {
     testConstants(vector<int>{4, 5}, move(bytecode.constants));
 }
 
+TEST(CompilerTest, TypeSpecializationTest) {
+    string input = "let a = 1; let b = \"x\"; let c = a + 2; let d = 1; let d = \"s\"; c * a; b + b; d + d; a - 1;";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+    
+    auto compiler = Compiler();
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+    auto bytecode = compiler.getByteCode();
+    // a and c only ever hold integers, b holds a string and d either type
+    vector<Instruction> expected = {
+        constructByteCode(OpConstant, vector<int>{0}),
+        constructByteCode(OpSetGlobal, vector<int>{0}),
+        constructByteCode(OpConstant, vector<int>{1}),
+        constructByteCode(OpSetGlobal, vector<int>{1}),
+        constructByteCode(OpGetGlobal, vector<int>{0}),
+        constructByteCode(OpConstant, vector<int>{2}),
+        constructByteCode(OpAddInt, vector<int>{}),
+        constructByteCode(OpSetGlobal, vector<int>{2}),
+        constructByteCode(OpConstant, vector<int>{0}),
+        constructByteCode(OpSetGlobal, vector<int>{3}),
+        constructByteCode(OpConstant, vector<int>{3}),
+        constructByteCode(OpSetGlobal, vector<int>{3}),
+        constructByteCode(OpGetGlobal, vector<int>{2}),
+        constructByteCode(OpGetGlobal, vector<int>{0}),
+        constructByteCode(OpMulInt, vector<int>{}),
+        constructByteCode(OpPop, vector<int>{}),
+        constructByteCode(OpGetGlobal, vector<int>{1}),
+        constructByteCode(OpGetGlobal, vector<int>{1}),
+        constructByteCode(OpAdd, vector<int>{}),
+        constructByteCode(OpPop, vector<int>{}),
+        constructByteCode(OpGetGlobal, vector<int>{3}),
+        constructByteCode(OpGetGlobal, vector<int>{3}),
+        constructByteCode(OpAdd, vector<int>{}),
+        constructByteCode(OpPop, vector<int>{}),
+        constructByteCode(OpGetGlobal, vector<int>{0}),
+        constructByteCode(OpConstant, vector<int>{0}),
+        constructByteCode(OpSubInt, vector<int>{}),
+        constructByteCode(OpPop, vector<int>{}),
+    };
+    testInstructions(concatInstructions(expected), bytecode.instructions);
+}
+
 TEST(CompilerTest, StringTest) {
     string input = "\"hello\";";
     Lexer l = Lexer(input);
@@ -379,10 +600,10 @@ TEST(CompilerTest, ArrayExpressionTest) {
         constructByteCode(OpConstant, vector<int>{0}),
         constructByteCode(OpConstant, vector<int>{1}),
         constructByteCode(OpConstant, vector<int>{2}),
-        constructByteCode(OpMul, vector<int>{}),
+        constructByteCode(OpMulInt, vector<int>{}),
         constructByteCode(OpConstant, vector<int>{3}),
         constructByteCode(OpConstant, vector<int>{4}),
-        constructByteCode(OpSub, vector<int>{}),
+        constructByteCode(OpSubInt, vector<int>{}),
         constructByteCode(OpArray, vector<int>{3}),
         constructByteCode(OpPop, vector<int>{}),
     };
@@ -406,14 +627,14 @@ TEST(CompilerTest, ArrayIndexTest) {
         constructByteCode(OpConstant, vector<int>{0}),
         constructByteCode(OpConstant, vector<int>{1}),
         constructByteCode(OpConstant, vector<int>{2}),
-        constructByteCode(OpMul, vector<int>{}),
+        constructByteCode(OpMulInt, vector<int>{}),
         constructByteCode(OpConstant, vector<int>{3}),
         constructByteCode(OpConstant, vector<int>{4}),
-        constructByteCode(OpSub, vector<int>{}),
+        constructByteCode(OpSubInt, vector<int>{}),
         constructByteCode(OpArray, vector<int>{3}),
         constructByteCode(OpConstant, vector<int>{5}),
         constructByteCode(OpConstant, vector<int>{6}),
-        constructByteCode(OpAdd, vector<int>{}),
+        constructByteCode(OpAddInt, vector<int>{}),
         constructByteCode(OpIndex, vector<int>{}),
         constructByteCode(OpPop, vector<int>{}),
     };
@@ -440,16 +661,16 @@ TEST(CompilerTest, HashTest) {
         constructByteCode(OpConstant, vector<int>{2}),
         constructByteCode(OpConstant, vector<int>{3}),
         constructByteCode(OpConstant, vector<int>{4}),
-        constructByteCode(OpMul, vector<int>{}),
+        constructByteCode(OpMulInt, vector<int>{}),
+        constructByteCode(OpConstant, vector<int>{1}),
+        constructByteCode(OpConstant, vector<int>{3}),
         constructByteCode(OpConstant, vector<int>{5}),
-        constructByteCode(OpConstant, vector<int>{6}),
-        constructByteCode(OpConstant, vector<int>{7}),
-        constructByteCode(OpSub, vector<int>{}),
+        constructByteCode(OpSubInt, vector<int>{}),
         constructByteCode(OpHash, vector<int>{6}),
         constructByteCode(OpPop, vector<int>{}),
     };
     testInstructions(concatInstructions(expected), bytecode.instructions);
-    testConstants(vector<int>{1, 3, 2, 4, 5, 3, 4, 6}, move(bytecode.constants));
+    testConstants(vector<int>{1, 3, 2, 4, 5, 6}, move(bytecode.constants));
 }
 
 TEST(CompilerTest, FnTest) {
@@ -473,7 +694,7 @@ TEST(CompilerTest, FnTest) {
     vector<Instruction> expectedConstants {
         constructByteCode(OpConstant, vector<int>{0}),
         constructByteCode(OpConstant, vector<int>{1}),
-        constructByteCode(OpAdd, vector<int>{}),
+        constructByteCode(OpAddInt, vector<int>{}),
         constructByteCode(OpRetVal, vector<int>{}),
     };
     vector<int> expectedInt = {2, 3};
@@ -507,7 +728,7 @@ TEST(CompilerTest, FnImplicitTest) {
     vector<Instruction> expectedConstants {
         constructByteCode(OpConstant, vector<int>{0}),
         constructByteCode(OpConstant, vector<int>{1}),
-        constructByteCode(OpAdd, vector<int>{}),
+        constructByteCode(OpAddInt, vector<int>{}),
         constructByteCode(OpRetVal, vector<int>{}),
     };
     vector<int> expectedInt = {2, 3};
@@ -655,7 +876,9 @@ TEST(CompilerTest, FnCallingBindingTest) {
     int error = p.parseProgram(&program);
     if (error) FAIL() << "test failed due to error in parser..." << endl;
     
-    auto compiler = Compiler();
+    CompilerOptions options;
+    options.inlineBudget = 0; // keep the call
+    auto compiler = Compiler(options);
     int err = compiler.compileProgram(&program);
     if (err) FAIL() << "test failed due to error in compiler..." << endl;
 
@@ -683,7 +906,203 @@ TEST(CompilerTest, FnCallingBindingTest) {
     CompiledFunction* instruct = dynamic_cast<CompiledFunction*>(bytecode.constants.at(2).get());
     testInstructions(concatInstructions(expectedConstants), instruct->instructions);
 }
+TEST(CompilerTest, InliningTest) {
+    string input = "let f = fn(){2; 3}; let g = fn(){[1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12]}; f(); g();";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+    
+    CompilerOptions options;
+    options.inlineBudget = 8;
+    auto compiler = Compiler(options);
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+    auto bytecode = compiler.getByteCode();
+    // f is inlined without its OpRetVal, g is over budget and still called
+    vector<Instruction> expected = {
+        constructByteCode(OpConstant, vector<int>{2}),
+        constructByteCode(OpSetGlobal, vector<int>{0}),
+        constructByteCode(OpConstant, vector<int>{13}), // 2 and 3 are shared with f
+        constructByteCode(OpSetGlobal, vector<int>{1}),
+        constructByteCode(OpConstant, vector<int>{0}),
+        constructByteCode(OpPop, vector<int>{}),
+        constructByteCode(OpConstant, vector<int>{1}),
+        constructByteCode(OpPop, vector<int>{}),
+        constructByteCode(OpGetGlobal, vector<int>{1}),
+        constructByteCode(OpCall, vector<int>{}),
+        constructByteCode(OpPop, vector<int>{}),
+    };
+    testInstructions(concatInstructions(expected), bytecode.instructions);
+    ASSERT_EQ(compiler.inlineDecisions.size(), 2);
+    ASSERT_TRUE(compiler.inlineDecisions.at(0).inlined);
+    ASSERT_FALSE(compiler.inlineDecisions.at(1).inlined);
+    ASSERT_EQ(compiler.inlineReport(), "f: inlined (6 bytes)\ng: not inlined (27 bytes over budget of 8)\n");
+
+    // a return inside an expression leaves the 5 pushed; as a jump it would stay on the caller's stack
+    input = "let f = fn() { 5 + if (true) { return 1; } else { 2 } }; 100 - f()";
+    l = Lexer(input);
+    p = Parser(l);
+    program = Program();
+    if (p.parseProgram(&program)) FAIL() << "test failed due to error in parser..." << endl;
+    compiler = Compiler();
+    if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+    ASSERT_EQ(compiler.inlineReport(), "f: not inlined (unbalanced stack)\n");
+    bytecode = compiler.getByteCode();
+    bool called = false;
+    for (auto& ins : InstructionRange(bytecode.instructions)) called = called || ins.opcode == OpCall;
+    ASSERT_TRUE(called);
+}
+
+TEST(CompilerTest, InliningRejectTest) {
+    string input = "let f = fn(){1}; let g = fn(){f()}; let f = fn(){2}; g();";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+    
+    auto compiler = Compiler();
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+    // f may hold either function when g runs, so only g is inlined
+    ASSERT_EQ(compiler.inlineReport(), "f: not inlined (bound more than once)\ng: inlined (4 bytes)\n");
+}
+
+TEST(CompilerTest, SsaTest) {
+    string input = "let x = 4; let f = fn(){ let y = x * x + x; 1 + 2; let z = x * x + x; y + z }; f();";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+
+    CompilerOptions options;
+    options.optimizationLevel = 2;
+    auto compiler = Compiler(options);
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+    auto bytecode = compiler.getByteCode();
+    // z reuses y, both are read back from y's global and the unused 1 + 2 is gone
+    vector<Instruction> expected = {
+        constructByteCode(OpGetGlobal, vector<int>{0}),
+        constructByteCode(OpGetGlobal, vector<int>{0}),
+        constructByteCode(OpMulInt, vector<int>{}),
+        constructByteCode(OpGetGlobal, vector<int>{0}),
+        constructByteCode(OpAddInt, vector<int>{}),
+        constructByteCode(OpSetGlobal, vector<int>{1}),
+        constructByteCode(OpGetGlobal, vector<int>{1}),
+        constructByteCode(OpSetGlobal, vector<int>{2}),
+        constructByteCode(OpGetGlobal, vector<int>{1}),
+        constructByteCode(OpGetGlobal, vector<int>{1}),
+        constructByteCode(OpAddInt, vector<int>{}),
+        constructByteCode(OpRetVal, vector<int>{}),
+    };
+    CompiledFunction* fn = dynamic_cast<CompiledFunction*>(bytecode.constants.at(3).get());
+    testInstructions(concatInstructions(expected), fn->instructions);
+}
+
+TEST(CompilerTest, PositionTableTest) {
+    string input = "let a = 1;\nlet f = fn() {\n  a * 2\n};\n  [f(),\n   a];";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+
+    auto compiler = Compiler();
+    int err = compiler.compileProgram(&program);
+    if (err) FAIL() << "test failed due to error in compiler..." << endl;
+    auto bytecode = compiler.getByteCode();
+
+    // the inlined call keeps the positions of f's body
+    vector<pair<OpCode, SourcePos>> expected = {
+        {OpConstant, {1, 9}},
+        {OpSetGlobal, {1, 1}},
+        {OpConstant, {2, 9}},
+        {OpSetGlobal, {2, 1}},
+        {OpGetGlobal, {3, 3}},
+        {OpConstant, {3, 7}},
+        {OpMulInt, {3, 5}},
+        {OpGetGlobal, {6, 4}},
+        {OpArray, {5, 3}},
+        {OpPop, {5, 3}},
+    };
+    auto code = decodeInstructions(bytecode.instructions);
+    ASSERT_EQ(code.size(), expected.size());
+    int offset = 0;
+    for (int i = 0; i < code.size(); i++) {
+        ASSERT_EQ(code.at(i).opcode, expected.at(i).first);
+        SourcePos pos = lookupPosition(bytecode.positions, offset);
+        ASSERT_EQ(pos.line, expected.at(i).second.line) << i;
+        ASSERT_EQ(pos.column, expected.at(i).second.column) << i;
+        offset += instructionLength(bytecode.instructions, offset);
+    }
+    // one entry per change of position, three bytes each while deltas are small
+    ASSERT_EQ(decodePositions(bytecode.positions).size(), 9);
+    ASSERT_EQ(bytecode.positions.size(), 27);
+
+    CompiledFunction* fn = dynamic_cast<CompiledFunction*>(bytecode.constants.at(2).get());
+    ASSERT_EQ(lookupPosition(fn->positions, 0).line, 3);
+    auto expanded = expandPositions(fn->positions, fn->instructions.size());
+    ASSERT_EQ(encodePositions(fn->instructions, expanded), fn->positions);
+}
+
 // int main(int argc, char** argv) {
 //     testing::InitGoogleTest(&argc, argv);
 //     return RUN_ALL_TESTS();
-// }
\ No newline at end of file
+// }
+
+TEST(CompilerTest, ParallelCompileTest) {
+    // many independent bodies plus ones that define globals, nest functions and call helpers
+    string input = "let helper = fn() { 7 }; let twice = fn() { 1 }; let twice = fn() { 2 };";
+    for (int i = 0; i < 300; i++) {
+        string n = to_string(i);
+        string id = string(1, 'a' + i / 26) + string(1, 'a' + i % 26); // identifiers cannot contain digits
+        input += "let f" + id + " = fn() { let g" + id + " = " + n + "; let s = \"s" + n + "\"; ";
+        if (i % 3 == 0) input += "let inner = fn() { g" + id + " * 2 }; ";
+        if (i % 5 == 0) input += "helper(); ";
+        if (i % 7 == 0) input += "twice(); ";
+        input += "while (g" + id + " < " + to_string(i + 3) + ") { let g" + id + " = g" + id + " + 1; }; ";
+        input += "if (g" + id + " > 10) { [g" + id + ", s] } else { {\"k\": g" + id + "} } }; ";
+    }
+    input += "fab(); fkn();";
+
+    auto compile = [&](int threads, ByteCode* bytecode, string* report) {
+        Lexer l = Lexer(input);
+        Parser p = Parser(l);
+        auto program = Program();
+        if (p.parseProgram(&program)) return 1;
+        CompilerOptions options;
+        options.compileThreads = threads;
+        auto compiler = Compiler(options);
+        if (compiler.compileProgram(&program)) return 1;
+        *report = compiler.inlineReport();
+        *bytecode = compiler.getByteCode();
+        return 0;
+    };
+    ByteCode sequential, parallel;
+    string sequentialReport, parallelReport;
+    if (compile(1, &sequential, &sequentialReport)) FAIL() << "test failed due to error in compiler..." << endl;
+    if (compile(8, &parallel, &parallelReport)) FAIL() << "test failed due to error in compiler..." << endl;
+
+    testInstructions(sequential.instructions, parallel.instructions);
+    ASSERT_EQ(sequential.positions, parallel.positions);
+    ASSERT_EQ(sequentialReport, parallelReport);
+    ASSERT_EQ(sequential.constants.size(), parallel.constants.size());
+    for (int i = 0; i < sequential.constants.size(); i++) {
+        Object* expected = sequential.constants.at(i).get();
+        Object* actual = parallel.constants.at(i).get();
+        ASSERT_EQ(expected->getType(), actual->getType());
+        if (expected->getType() == objs.COMPILED_FUNCTION_OBJ) {
+            testInstructions(dynamic_cast<CompiledFunction*>(expected)->instructions, dynamic_cast<CompiledFunction*>(actual)->instructions);
+            ASSERT_EQ(dynamic_cast<CompiledFunction*>(expected)->positions, dynamic_cast<CompiledFunction*>(actual)->positions);
+        } else {
+            ASSERT_EQ(expected->serialize(), actual->serialize());
+        }
+    }
+}
@@ -265,6 +265,23 @@ TEST(ParserTest, IfElseLongTest) {
     ASSERT_EQ(exp->serialize(), "if (x < (y + 3)) {let x = (--3 + (4 * 5));} else {let y = (x / y);}");
 }
 
+TEST(ParserTest, WhileTest) {
+    string input = "while (i < 10) { let i = i + 1; }; i;";
+    Lexer l = Lexer(input);
+    Parser p = Parser(l);
+    auto program = Program();
+    int error = p.parseProgram(&program);
+    if (error) FAIL() << "test failed due to error in parser..." << endl;
+    ASSERT_EQ(program.statements.size(), 2);
+    WhileStatement* stmt = dynamic_cast<WhileStatement*>(program.statements.at(0).get());
+    InfixExpression* condition = dynamic_cast<InfixExpression*>(stmt->condition.get());
+    ASSERT_EQ(condition->Operator, "<");
+    ASSERT_EQ(stmt->body->statements.size(), 1);
+    LetStatement* let = dynamic_cast<LetStatement*>(stmt->body->statements.at(0).get());
+    ASSERT_EQ(let->identifier.value, "i");
+    ASSERT_EQ(stmt->serialize(), "while (i < 10) {let i = (i + 1);}");
+}
+
 TEST(ParserTest, FnTest) {
     string input = "fn(x, y) { return x + y; }";
     Lexer l = Lexer(input);
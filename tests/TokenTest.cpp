@@ -329,4 +329,51 @@ TEST(TokenTest, HashIndexTest) {
 int main(int argc, char** argv) {
     testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
-}
\ No newline at end of file
+}
+
+TEST(TokenTest, WhileTest) {
+    const string input = "while (x) {};";
+    auto l = Lexer(input);
+
+    Token tests[] = {
+        {types.WHILE, "while"},
+        {types.LPAREN, "("},
+        {types.IDENT, "x"},
+        {types.RPAREN, ")"},
+        {types.LBRACE, "{"},
+        {types.RBRACE, "}"},
+        {types.SEMICOLON, ";"},
+        {types.EoF, ""}
+    };
+
+    for (Token test : tests) {
+        Token tok = l.nextToken();
+        ASSERT_EQ(test.type, tok.type);
+        ASSERT_EQ(test.literal, tok.literal);
+    }
+}
+
+TEST(TokenTest, PositionTest) {
+    const string input = "let x = 10;\n  x == \"a b\";\n\n}";
+    auto l = Lexer(input);
+
+    Token tests[] = {
+        {types.LET, "let", 1, 1},
+        {types.IDENT, "x", 1, 5},
+        {types.ASSIGN, "=", 1, 7},
+        {types.INT, "10", 1, 9},
+        {types.SEMICOLON, ";", 1, 11},
+        {types.IDENT, "x", 2, 3},
+        {types.EQ, "==", 2, 5},
+        {types.STRING, "a b", 2, 8},
+        {types.SEMICOLON, ";", 2, 13},
+        {types.RBRACE, "}", 4, 1},
+    };
+
+    for (Token test : tests) {
+        Token tok = l.nextToken();
+        ASSERT_EQ(test.type, tok.type);
+        ASSERT_EQ(test.line, tok.line) << tok.literal;
+        ASSERT_EQ(test.column, tok.column) << tok.literal;
+    }
+}
@@ -1,4 +1,4 @@
-#include"../vm.cpp"
+#include"../session.cpp"
 #include<iostream>
 #include<gtest/gtest.h>
 
@@ -31,6 +31,7 @@ TEST(VMTest, VMIntegerTest) {
         {"4 * 3", 12},
         {"4 / 2", 2},
         {"-2 - 2", -4},
+        {"let a = 6; let b = a * 7; b / 2 - a;", 15},
     };
     for (auto test : tests) {
         auto program = Program();
@@ -42,9 +43,8 @@ TEST(VMTest, VMIntegerTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        Integer* integer = dynamic_cast<Integer*>(obj.get());
-        ASSERT_EQ(integer->value, test.expected);
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(obj.integer, test.expected);
 
     }
 }
@@ -58,6 +58,8 @@ TEST(VMTest, VMBooleanTest) {
         {"1 > 1", false},
         {"1 == 1", true},
         {"1 != 1", false},
+        {"2 == 3", false},
+        {"1000 != 1000", false},
         {"true == true", true},
         {"!true != true", true},
         {"true != false", true},
@@ -76,9 +78,8 @@ TEST(VMTest, VMBooleanTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        Boolean* boolean = dynamic_cast<Boolean*>(obj.get());
-        ASSERT_EQ(boolean->value, test.expected);
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(obj.boolean, test.expected);
         // ASSERT_EQ(vm.sp, 0);
     }
 }
@@ -88,7 +89,10 @@ TEST(VMTest, VMConditionalTest) {
         {"if (true) {1};", 1},
         {"if (true) {2} else {3};", 2},
         {"if (false) {2} else {3};", 3},
-        {"if (if (false) {1};) {3} else {4};", 4}
+        {"if (if (false) {1};) {3} else {4};", 4},
+        {"let t = 2 > 1; if (t) {1}; if (t) {2} else {3}; 9;", 9},
+        {"let f = fn(){if (2 > 1) {let a = 1;}; 5;}; f();", 5},
+        {"let f = fn(){if (1 > 2) {return 1;} else {return 2;}}; f();", 2}
     };
     for (auto test : tests) {
         auto program = Program();
@@ -100,9 +104,8 @@ TEST(VMTest, VMConditionalTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        Integer* integer = dynamic_cast<Integer*>(obj.get());
-        ASSERT_EQ(integer->value, test.expected);
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(obj.integer, test.expected);
     }
 }
 
@@ -122,8 +125,8 @@ TEST(VMTest, VMConditionalNullTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        ASSERT_EQ(test.expected.getType(), obj.get()->getType());
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(test.expected.getType(), obj.getType());
     }
 }
 
@@ -143,16 +146,16 @@ TEST(VMTest, VMLetTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        Integer* integer = dynamic_cast<Integer*>(obj.get());
-        ASSERT_EQ(integer->value, test.expected);
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(obj.integer, test.expected);
     }
 }
 
 TEST(VMTest, StringTest) {
     vector<VMTest<string>> tests = {
         {"\"hello\"", "hello"},
-        {"\"he\" + \"llo\"", "hello"}
+        {"\"he\" + \"llo\"", "hello"},
+        {"let a = 1; let a = \"a\"; a + a;", "aa"}
     };
     for (auto test : tests) {
         auto program = Program();
@@ -164,8 +167,8 @@ TEST(VMTest, StringTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        String* lit = dynamic_cast<String*>(obj.get());
+        Value& obj = vm.getLastPopped();
+        String* lit = dynamic_cast<String*>(obj.object);
         ASSERT_EQ(lit->value, test.expected);
     }
 }
@@ -186,12 +189,11 @@ TEST(VMTest, ArrayTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        Array* lit = dynamic_cast<Array*>(obj.get());
+        Value& obj = vm.getLastPopped();
+        Array* lit = dynamic_cast<Array*>(obj.object);
         ASSERT_EQ(lit->elements.size(), test.expected.size());
         for (int i = 0; i < test.expected.size(); i++) {
-            Integer* intLit = dynamic_cast<Integer*>(lit->elements.at(i).get());
-            ASSERT_EQ(intLit->value, test.expected.at(i));
+            ASSERT_EQ(lit->elements.at(i).integer, test.expected.at(i));
         }
     }
 }
@@ -212,15 +214,12 @@ TEST(VMTest, HashTableTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        HashTable* hash = dynamic_cast<HashTable*>(obj.get());
-        ASSERT_EQ(hash->table.size(), test.expected.size());
-        int i = 0;
-        for (auto& entry : hash->table) {
-            Integer* key = dynamic_cast<Integer*>(entry.second.get()->key.get());
-            ASSERT_EQ(key->value, test.expected.at(i).first);
-            Integer* key2 = dynamic_cast<Integer*>(entry.second.get()->value.get());
-            ASSERT_EQ(key2->value, test.expected.at(i++).second);
+        Value& obj = vm.getLastPopped();
+        HashTable* hash = dynamic_cast<HashTable*>(obj.object);
+        ASSERT_EQ(hash->size(), test.expected.size());
+        for (int i = 0; i < hash->size(); i++) {
+            ASSERT_EQ(hash->key(i).integer, test.expected.at(i).first);
+            ASSERT_EQ(hash->value(i).integer, test.expected.at(i).second);
         }
         // ASSERT_EQ(hash->serialize(), "{1: 2, 3: 4}");
     }
@@ -231,7 +230,7 @@ TEST(VMTest, ArrayIndexTest) {
         {"[1, 2, 3][1]", 2},
         {"[1, 3, 5 * 4][4 - 2]", 20},
         {"{1: 2, 3: 4, 2: 1}[3]", 4},
-        // {"{\"hello\": 2, \"world\": 6}[\"hello\"]", 2}
+        {"{\"hello\": 2, \"world\": 6}[\"hello\"]", 2}
     };
     for (auto test : tests) {
         auto program = Program();
@@ -243,9 +242,8 @@ TEST(VMTest, ArrayIndexTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        Integer* integer = dynamic_cast<Integer*>(obj.get());
-        ASSERT_EQ(integer->value, test.expected);
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(obj.integer, test.expected);
     }
 }
 
@@ -267,8 +265,8 @@ TEST(VMTest, ArrayIndexNullTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        ASSERT_EQ(test.expected.getType(), obj.get()->getType());
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(test.expected.getType(), obj.getType());
     }
 }
 
@@ -278,7 +276,9 @@ TEST(VMTest, FnCallingTest) {
         {"let f = fn(){return 2 + 3;}; f();", 5},
         {"let a = fn(){return 1;}; let b = fn(){return 2 + a();}; let c = fn(){b() + 3;}; c();", 6},
         {"let a = fn(){return 1; 2;}; a();", 1},
-        {"let a = fn(){return 1; return 2;}; a();", 1}
+        {"let a = fn(){return 1; return 2;}; a();", 1},
+        {"let a = fn(){if (1 > 2) {return 1;}; 7;}; a() + a();", 14},
+        {"let a = fn(){1}; let b = fn(){a()}; let a = fn(){2}; b();", 2}
     };
     for (auto test : tests) {
         auto program = Program();
@@ -291,9 +291,8 @@ TEST(VMTest, FnCallingTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        Integer* integer = dynamic_cast<Integer*>(obj.get());
-        ASSERT_EQ(integer->value, test.expected);
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(obj.integer, test.expected);
 
     }
 }
@@ -314,8 +313,8 @@ TEST(VMTest, FnCallingNullTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        ASSERT_EQ(test.expected.getType(), obj.get()->getType());
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(test.expected.getType(), obj.getType());
     }
 }
 
@@ -333,9 +332,538 @@ TEST(VMTest, FirstClassFnTest) {
         auto vm = VM(compiler.getByteCode());
         if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
 
-        unique_ptr<Object>& obj = vm.getLastPopped();
-        Integer* integer = dynamic_cast<Integer*>(obj.get());
-        ASSERT_EQ(integer->value, test.expected);
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(obj.integer, test.expected);
 
     }
-}
\ No newline at end of file
+}
+TEST(VMTest, WideOperandTest) {
+    // enough literals for constant indices and if-arm jumps to need OpWide prefixes
+    string sum = "1";
+    for (int i = 1; i < 1000; i++) sum += " + 1";
+    string block = "";
+    for (int i = 0; i < 10000; i++) block += "1; ";
+    // an alternative with wide constants widens the jump over it after the false branch was patched
+    string strings = "";
+    for (int i = 0; i < 12000; i++) strings += "\"s" + to_string(i) + "\"; ";
+    vector<VMTest<int>> tests = {
+        {sum, 1000},
+        {"if (true) {" + block + "2} else {0};", 2},
+        {"if (false) {" + block + "2} else {7};", 7},
+        {"if (false) {1} else {" + strings + "7};", 7},
+        {"if (true) {1} else {" + strings + "7};", 1},
+    };
+    for (auto test : tests) {
+        for (int level = 0; level <= 2; level++) {
+            auto program = Program();
+            parse(test.input, &program);
+            CompilerOptions options;
+            options.optimizationLevel = level;
+            auto compiler = Compiler(options);
+            int err = compiler.compileProgram(&program);
+            if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+            auto vm = VM(compiler.getByteCode());
+            ASSERT_TRUE(vm.verified) << "level " << level;
+            if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+
+            Value& obj = vm.getLastPopped();
+            ASSERT_EQ(obj.integer, test.expected) << "level " << level;
+        }
+    }
+}
+
+TEST(VMTest, WhileTest) {
+    vector<VMTest<int>> tests = {
+        {"let i = 0; let sum = 0; while (i < 1000) { let sum = sum + i; let i = i + 1; }; sum;", 499500},
+        {"let i = 0; while (false) { let i = 1; }; i;", 0},
+        {"let i = 0; while (i < 5) { if (i > 2) { 1; }; let i = i + 1; }; i;", 5},
+        {"let f = fn(){ let i = 0; while (true) { let i = i + 1; if (i > 9) { return i; }; }; }; f();", 10}
+    };
+    for (auto test : tests) {
+        auto program = Program();
+        parse(test.input, &program);
+        auto compiler = Compiler();
+        int err = compiler.compileProgram(&program);
+        if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+        auto vm = VM(compiler.getByteCode());
+        if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+
+        Value& obj = vm.getLastPopped();
+        ASSERT_EQ(obj.integer, test.expected);
+    }
+}
+
+TEST(VMTest, SsaTest) {
+    vector<string> tests = {
+        "let x = 4; let f = fn(){ let y = x * x + x; 1 + 2; let z = x * x + x; y + z }; f();",
+        "let i = 0; let s = 0; while (i < 50) { let s = s + i * i * i + i * i * i; let i = i + 1; }; [s, i * i];",
+        "let a = 3; let f = fn() { if (a > 2) { a * a * a } else { a * a * a + 1 } }; let a = 1; f() + a;",
+        "let n = 9; let f = fn() { let i = 0; let s = 0; while (i < 1000) { if (i > n * n + n) { let s = s + n * n + n; }; let i = i + 1; }; s }; f();",
+        "let g = fn() { let t = 5; t }; let h = fn() { let u = g() + g(); let t = 1; u + t }; h();",
+        "let s = \"a\"; let t = s + s; let u = s + s; [t, u];",
+    };
+    for (auto input : tests) {
+        vector<string> results;
+        vector<long long> executed;
+        for (int level = 1; level <= 2; level++) {
+            auto program = Program();
+            parse(input, &program);
+            CompilerOptions options;
+            options.optimizationLevel = level;
+            auto compiler = Compiler(options);
+            int err = compiler.compileProgram(&program);
+            if (err) FAIL() << "test failed due to error in compiler..." << endl;
+
+            auto vm = VM(compiler.getByteCode());
+            if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+            results.push_back(vm.getLastPopped().serialize());
+            executed.push_back(vm.executedInstructions);
+        }
+        ASSERT_EQ(results.at(0), results.at(1)) << input;
+        ASSERT_LE(executed.at(1), executed.at(0)) << input;
+#ifdef COUNT_INSTRUCTIONS
+        ASSERT_GT(executed.at(1), 0) << input;
+#endif
+    }
+}
+
+TEST(VMTest, ImageTest) {
+    vector<VMTest<string>> tests = {
+        {"let a = 6; let b = a * 7; b / 2 - a;", "15"},
+        {"let s = \"mon\" + \"key\"; s;", "monkey"},
+        {"let f = fn() { let i = 0; while (i < 5) { let i = i + 1; }; i }; [f(), f() + 1];", "[5, 6]"},
+    };
+    string path = testing::TempDir() + "vmtest.img";
+    for (auto test : tests) {
+        auto program = Program();
+        parse(test.input, &program);
+        auto compiler = Compiler();
+        int err = compiler.compileProgram(&program);
+        if (err) FAIL() << "test failed due to error in compiler..." << endl;
+        auto bytecode = compiler.getByteCode();
+        if (writeImage(path, bytecode, compiler.getSymbolTable())) FAIL() << "test failed due to error writing image..." << endl;
+
+        ByteCode loaded;
+        SymbolTable symbols;
+        if (loadImage(path, &loaded, &symbols)) FAIL() << "test failed due to error loading image..." << endl;
+        ASSERT_EQ(loaded.instructions, bytecode.instructions);
+        ASSERT_EQ(loaded.positions, bytecode.positions);
+        ASSERT_EQ(loaded.constants.size(), bytecode.constants.size());
+        ASSERT_EQ(symbols.numDefs, compiler.getSymbolTable().numDefs);
+
+        auto vm = VM(move(loaded));
+        if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+        ASSERT_EQ(vm.getLastPopped().serialize(), test.expected);
+    }
+
+    {
+        ofstream out(path, ios::binary | ios::trunc);
+        out << "not an image";
+    }
+    ByteCode loaded;
+    SymbolTable symbols;
+    ASSERT_EQ(loadImage(path, &loaded, &symbols), 1);
+    remove(path.c_str());
+}
+
+TEST(VMTest, SessionTest) {
+    vector<VMTest<string>> tests = {
+        {"let a = 1;", ""},
+        {"a + 2", "3"},
+        {"let f = fn() { a + a };", ""},
+        {"f()", "2"},
+        {"let a = \"x\";", ""},
+        {"f()", "xx"}, // f must not have been specialized for integer a
+        {"let g = fn() { 5 }; let g = fn() { 6 };", ""},
+        {"g()", "6"},
+        {"let i = 0; while (i < 3) { let i = i + 1; }; [i, \"s\"]", "[3, s]"},
+        {"let b = c;", "error in compiler..."},
+        {"i * 2", "6"},
+        // constants of a line that fails to compile are dropped, not handed out later
+        {"9000 + zzz + 7 + \"t\";", "error in compiler..."},
+        {"let b = 2;", ""},
+        {"[a, b, 9000, 7, \"t\"]", "[x, 2, 9000, 7, t]"},
+        {"[7, 9000 + 1]", "[7, 9001]"},
+        // and so are its definitions
+        {"let h = fn() { 5 }; let q = undefinedThing;", "error in compiler..."},
+        {"h()", "error in compiler..."},
+        {"q", "error in compiler..."},
+        {"let h = fn() { 8 }; h()", "8"},
+    };
+    auto session = Session();
+    for (auto test : tests) {
+        string result;
+        session.eval(test.input, &result);
+        ASSERT_EQ(result, test.expected) << test.input;
+    }
+}
+
+/* The bytecode of input, compiled as the next line of compiler's session */
+ByteCode sessionLine(Compiler& compiler, string input) {
+    auto program = Program();
+    parse(input, &program);
+    if (compiler.compileProgram(&program)) return ByteCode{};
+    return compiler.takeByteCode();
+}
+
+TEST(VMTest, LoadTest) {
+    // a program that does not decode fails on its own, the next one runs
+    CompilerOptions options;
+    options.incremental = true;
+    auto compiler = Compiler(options);
+    auto vm = VM(sessionLine(compiler, "let a = 1;"));
+    ASSERT_EQ(vm.run(), 0);
+    vm.load(ByteCode{Instruction{(byte) numOpCodes}});
+    ASSERT_FALSE(vm.predecoded);
+    ASSERT_EQ(vm.run(), 1);
+    vm.load(sessionLine(compiler, "a + 2"));
+    ASSERT_TRUE(vm.predecoded);
+    ASSERT_EQ(vm.run(), 0);
+    ASSERT_EQ(vm.getLastPopped().integer, 3);
+
+    // so does one that fails the verifier, which runs checked
+    auto unverified = sessionLine(compiler, "a + 4");
+    unverified.maxStack++;
+    vm.load(move(unverified));
+    ASSERT_FALSE(vm.verified);
+    ASSERT_EQ(vm.run(), 0);
+    ASSERT_EQ(vm.getLastPopped().integer, 5);
+    vm.load(sessionLine(compiler, "a + 6"));
+    ASSERT_TRUE(vm.verified);
+    ASSERT_EQ(vm.run(), 0);
+
+    // unless it brought functions, which later programs may call
+    unverified = sessionLine(compiler, "let f = fn() { a };");
+    unverified.maxStack++;
+    vm.load(move(unverified));
+    ASSERT_EQ(vm.run(), 0);
+    vm.load(sessionLine(compiler, "f() + 1"));
+    ASSERT_FALSE(vm.verified);
+    ASSERT_EQ(vm.run(), 0);
+    ASSERT_EQ(vm.getLastPopped().integer, 2);
+}
+
+TEST(VMTest, VerifierTest) {
+    vector<VMTest<string>> tests = {
+        {"let f = fn() { if (true) { return 1; }; 2 }; [f(), {\"k\": f()}[\"k\"]]", "[1, 1]"},
+        {"let i = 0; while (i < 3) { let i = i + 1; }; i", "3"},
+    };
+    for (auto test : tests) {
+        auto program = Program();
+        parse(test.input, &program);
+        auto compiler = Compiler();
+        if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+        auto vm = VM(compiler.getByteCode());
+        ASSERT_TRUE(vm.verified) << test.input;
+        if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+        ASSERT_EQ(vm.getLastPopped().serialize(), test.expected);
+    }
+
+    // unbounded recursion fails cleanly on the unchecked path
+    auto program = Program();
+    parse("let f = fn() { 0 }; let g = fn() { f() }; let f = g; f();", &program);
+    auto compiler = Compiler();
+    if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+    auto vm = VM(compiler.getByteCode());
+    ASSERT_TRUE(vm.verified);
+    ASSERT_EQ(vm.run(), 1);
+
+    vector<Instruction> rejected = {
+        Instruction{OpPop}, // stack underflow
+        constructByteCode(OpConstant, vector<int>{1}), // no such constant
+        Instruction{OpJump, (byte) 0, (byte) 1, OpConstant, (byte) 0}, // into an operand
+        Instruction{OpTrue, OpJumpIfFalse, (byte) 0, (byte) 1, OpNull}, // depths disagree
+        Instruction{OpRet}, // return from the main program
+        Instruction{OpJump, (byte) 0}, // truncated operand
+    };
+    auto verify = [&](Instruction code, int maxStack) {
+        ByteCode bytecode;
+        bytecode.instructions = code;
+        bytecode.maxStack = maxStack;
+        bytecode.constants.push_back(make_unique<Integer>(1));
+        int numGlobals = 0;
+        return verifyProgram(bytecode, 0, &numGlobals);
+    };
+    for (auto& code : rejected) ASSERT_EQ(verify(code, -1), 1) << serialize(code);
+    ASSERT_EQ(verify(constructByteCode(OpConstant, vector<int>{0}), -1), 0);
+    ASSERT_EQ(verify(constructByteCode(OpConstant, vector<int>{0}), 1), 0);
+    ASSERT_EQ(verify(constructByteCode(OpConstant, vector<int>{0}), 0), 1); // wrong recorded depth
+
+    // code that fails verification still runs, with every access checked
+    ByteCode bytecode;
+    bytecode.instructions = Instruction{OpConstant, (byte) 0, OpPop, OpPop};
+    bytecode.constants.push_back(make_unique<Integer>(1));
+    auto unverified = VM(move(bytecode));
+    ASSERT_FALSE(unverified.verified);
+    ASSERT_THROW(unverified.run(), out_of_range);
+}
+
+TEST(VMTest, FrameSizeTest) {
+    auto program = Program();
+    parse("let f = fn() { let a = 1; [a, a, a] }; let g = fn() { f() }; [g(), g()]", &program);
+    CompilerOptions options;
+    options.optimizationLevel = 0; // keep the calls
+    auto compiler = Compiler(options);
+    if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+    auto bytecode = compiler.getByteCode();
+    ASSERT_EQ(bytecode.maxStack, 2);
+    CompiledFunction* f = dynamic_cast<CompiledFunction*>(bytecode.constants.at(1).get());
+    ASSERT_EQ(f->maxStack, 3);
+
+    auto vm = VM(move(bytecode));
+    ASSERT_TRUE(vm.verified);
+    ASSERT_EQ(vm.stack.size(), 3);
+    ASSERT_EQ(vm.globals.size(), compiler.getSymbolTable().numDefs);
+    if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+    ASSERT_EQ(vm.getLastPopped().serialize(), "[[1, 1, 1], [1, 1, 1]]");
+    ASSERT_EQ(vm.stack.size(), 6); // grown once, for the frame of f
+}
+
+TEST(VMTest, PredecodeTest) {
+    deque<Value> constants;
+    constants.push_back(integerValue(7));
+    Instruction code = {OpTrue, OpJumpIfFalse, (byte) 0, (byte) 1, OpNull};
+    auto global = constructByteCode(OpGetGlobal, vector<int>{300});
+    code.insert(code.end(), global.begin(), global.end());
+    SlotCode slots;
+    ASSERT_EQ(predecode(code, constants, &slots), 0);
+    ASSERT_EQ(slots, (SlotCode{(uint32_t) OpTrue, (uint32_t) OpJumpIfFalse, 4, (uint32_t) OpNull, (uint32_t) OpGetGlobal, 300}));
+
+    ASSERT_EQ(predecode(constructByteCode(OpConstant, vector<int>{0}), constants, &slots), 0);
+    ASSERT_EQ(slots.size(), 1 + pointerSlots);
+    ASSERT_EQ(readPointer(&slots[1]), &constants.at(0));
+
+    ASSERT_EQ(predecode(constructByteCode(OpConstant, vector<int>{1}), constants, &slots), 1); // no such constant
+    ASSERT_EQ(predecode(Instruction{OpJump, (byte) 0, (byte) 1, OpConstant, (byte) 0}, constants, &slots), 1); // into an operand
+}
+
+TEST(VMTest, DispatchTest) {
+    vector<string> inputs = {
+        "let f = fn() { if (true) { return [1, \"a\"]; }; 2 }; let i = 0; while (i < 3) { let i = i + 1; }; [f(), i, {1: 2}[1]]",
+        "let g = fn() { }; g()",
+    };
+    for (auto& input : inputs) {
+        string results[2];
+        long long executed[2];
+        for (int threaded = 0; threaded <= 1; threaded++) {
+            auto program = Program();
+            parse(input, &program);
+            auto compiler = Compiler();
+            if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+            auto vm = VM(compiler.getByteCode());
+            vm.threadedDispatch = threaded;
+            if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+            results[threaded] = vm.getLastPopped().serialize();
+            executed[threaded] = vm.executedInstructions;
+        }
+        ASSERT_EQ(results[0], results[1]) << input;
+        ASSERT_EQ(executed[0], executed[1]) << input;
+    }
+}
+
+TEST(VMTest, ValueTest) {
+    ASSERT_EQ(sizeof(Value), 16);
+
+    vector<pair<string, ValueKind>> tests = {
+        {"let a = [1, 2]; a[0] + 3", IntegerValue},
+        {"1 < 2", BooleanValue},
+        {"{1: 2}[3]", NullValue},
+        {"\"a\" + \"b\"", ObjectValue},
+    };
+    for (auto& test : tests) {
+        auto program = Program();
+        parse(test.first, &program);
+        auto compiler = Compiler();
+        if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+        auto vm = VM(compiler.getByteCode());
+        if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+        ASSERT_EQ(vm.getLastPopped().kind, test.second) << test.first;
+    }
+}
+
+TEST(VMTest, SharedValueTest) {
+    Heap heap;
+    Value str = heap.allocate<String>("s");
+    Value copy = str;
+    ASSERT_EQ(copy.object, str.object);
+
+    // reads of globals, elements and hash values share, and never empty the original
+    vector<pair<string, string>> tests = {
+        {"let a = [1, [2]]; let b = a; [a, b, a[1], a[1], a]", "[[1, [2]], [1, [2]], [2], [2], [1, [2]]]"},
+        {"let h = {1: [2], 3: \"x\"}; [h[1], h[1], h[3], h]", "[[2], [2], x, {1: [2], 3: x}]"},
+        {"let f = fn() { 1 }; let g = f; [f(), g(), f()]", "[1, 1, 1]"},
+    };
+    for (auto& test : tests) {
+        auto program = Program();
+        parse(test.first, &program);
+        auto compiler = Compiler();
+        if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+        auto vm = VM(compiler.getByteCode());
+        if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+        ASSERT_EQ(vm.getLastPopped().serialize(), test.second) << test.first;
+    }
+}
+
+TEST(VMTest, GarbageCollectionTest) {
+    auto program = Program();
+    parse("let i = 0; let a = []; while (i < 5000) { let a = [i, \"x\" + \"y\", {i: [i]}]; let i = i + 1; }; a", &program);
+    auto compiler = Compiler();
+    if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+    auto vm = VM(compiler.getByteCode());
+    vm.heap.minThreshold = vm.heap.threshold = 4096;
+    if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+    ASSERT_EQ(vm.getLastPopped().serialize(), "[4999, xy, {4999: [4999]}]");
+    ASSERT_GT(vm.heap.stats.collections, 10);
+    ASSERT_GT(vm.heap.stats.bytesFreed, 0);
+    ASSERT_LT(vm.heap.bytes, 3 * 4096); // flat, whatever the number of iterations
+
+    // only what globals, constants and the last popped value reach survives
+    vm.heap.collect(vm.roots());
+    ASSERT_EQ(vm.heap.stats.liveObjects, 6); // the array, its string, hash and inner array, the constants "x" and "y"
+    ASSERT_EQ(vm.getLastPopped().serialize(), "[4999, xy, {4999: [4999]}]");
+}
+
+TEST(VMTest, IncrementalCollectionTest) {
+    // a large live array of arrays in a global, and garbage made while it is marked
+    auto program = Program();
+    parse("let i = 0; let big = []; while (i < 2000) { let big = [big, [i, i]]; let i = i + 1; }; let i = 0; let s = \"\"; while (i < 3000) { let s = [\"x\" + \"y\", i]; let i = i + 1; }; [big[1], s]", &program);
+    auto compiler = Compiler();
+    if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+    auto vm = VM(compiler.getByteCode());
+    vm.heap.incremental = true;
+    vm.heap.minThreshold = vm.heap.threshold = 4096;
+    vm.heap.sliceBytes = 512;
+    vm.heap.maxPauseMs = 0; // a slice stops after its first batch of objects
+    if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+    ASSERT_EQ(vm.getLastPopped().serialize(), "[[1999, 1999], [xy, 2999]]");
+    ASSERT_GT(vm.heap.stats.collections, 1);
+    ASSERT_GT(vm.heap.stats.pauses, 10 * vm.heap.stats.collections); // spread over many slices
+    long long pauses = 0;
+    for (auto count : vm.heap.stats.pauseHistogram) pauses += count;
+    ASSERT_EQ(pauses, vm.heap.stats.pauses);
+
+    // the same heap is left when the last cycle is finished at once
+    vm.heap.collect(vm.roots());
+    ASSERT_EQ(vm.heap.phase, GcIdle);
+    ASSERT_EQ(vm.getLastPopped().serialize(), "[[1999, 1999], [xy, 2999]]");
+}
+
+TEST(VMTest, WriteBarrierTest) {
+    Heap heap;
+    heap.incremental = true;
+    heap.maxPauseMs = 0;
+    vector<Value> stack, globals(40);
+    deque<Value> constants;
+    for (int i = 0; i < 40; i++) globals.at(i) = heap.allocate<String>(to_string(i));
+    HeapRoots roots = {&stack, -1, &globals, &constants};
+    heap.step(roots); // marks the empty stack
+    heap.step(roots); // scans the first globals only
+    ASSERT_EQ(heap.phase, GcMarking);
+    ASSERT_LT(heap.globalsScanned, globals.size());
+
+    // a value moves from an unscanned global to a scanned one, as OpSetGlobal does
+    Value moved = globals.back();
+    heap.overwrite(globals.at(0));
+    globals.at(0) = moved;
+    heap.overwrite(globals.back());
+    globals.back() = Value();
+    while (heap.phase != GcIdle) heap.step(roots);
+    ASSERT_EQ(heap.stats.liveObjects, 40); // the old value of the first global survives this cycle
+    ASSERT_EQ(globals.at(0).serialize(), "39");
+    heap.collect(roots);
+    ASSERT_EQ(heap.stats.liveObjects, 39);
+}
+
+TEST(VMTest, SlabAllocatorTest) {
+    SlabAllocator slabs;
+    ASSERT_EQ(SlabAllocator::sizeClass(1), 0);
+    ASSERT_EQ(SlabAllocator::sizeClass(16), 0);
+    ASSERT_EQ(SlabAllocator::sizeClass(17), 1);
+    void* a = slabs.allocate(40);
+    void* b = slabs.allocate(48);
+    ASSERT_EQ((char*) b - (char*) a, 48); // same class, next block of the slab
+    ASSERT_EQ((uintptr_t) a % slabGranularity, 0);
+    slabs.deallocate(a, 40);
+    ASSERT_EQ(slabs.allocate(33), a); // the free list is reused first
+    ASSERT_EQ(slabs.stats.bytesInUse, 96);
+    ASSERT_EQ(slabs.stats.bytesReserved, slabSize);
+    void* large = slabs.allocate(slabClasses * slabGranularity + 1);
+    ASSERT_EQ(slabs.stats.largeAllocations, 1);
+    slabs.deallocate(large, slabClasses * slabGranularity + 1);
+
+    // objects freed by a collection are reused by the next allocations of their size
+    Heap heap;
+    Object* garbage = heap.allocate<String>("x").object;
+    ASSERT_EQ(garbage->blockSize, sizeof(String));
+    vector<Value> stack, globals;
+    deque<Value> constants;
+    heap.collect(HeapRoots{&stack, -1, &globals, &constants});
+    ASSERT_EQ(heap.slabs.stats.frees, 1);
+    ASSERT_EQ(heap.allocate<String>("y").object, garbage);
+}
+
+TEST(VMTest, ObjectKindTest) {
+    ASSERT_EQ(sizeof(Object), 24);
+    ASSERT_EQ(sizeof(Integer), 32); // one int after the header
+    Heap heap;
+    Value str = heap.allocate<String>("x");
+    ASSERT_EQ(str.object->kind, StringObject);
+    ASSERT_EQ(str.getType(), objs.STRING_OBJ);
+    ASSERT_EQ(heap.allocate<Array>(vector<Value>()).object->getType(), objs.ARRAY_OBJ);
+    ASSERT_EQ(CompiledFunction(Instruction()).getType(), objs.COMPILED_FUNCTION_OBJ);
+
+    // indexing and calling check the kind before casting
+    vector<pair<string, Value>> tests = {
+        {"\"ab\"[0]", Value()},
+        {"let f = 1; f();", Value()},
+        {"[1, 2][1]", integerValue(2)},
+        {"{\"a\": 3}[\"a\"]", integerValue(3)},
+    };
+    for (auto& test : tests) {
+        Lexer l = Lexer(test.first);
+        Parser p = Parser(l);
+        auto program = Program();
+        ASSERT_EQ(p.parseProgram(&program), 0);
+        auto compiler = Compiler();
+        ASSERT_EQ(compiler.compileProgram(&program), 0);
+        auto vm = VM(compiler.getByteCode());
+        ASSERT_EQ(vm.run(), test.second.empty() ? 1 : 0) << test.first;
+        if (!test.second.empty()) ASSERT_EQ(vm.getLastPopped().serialize(), test.second.serialize());
+    }
+}
+
+TEST(VMTest, FlatHashTableTest) {
+    // keys are compared, not just their hashes, and later keys win
+    vector<pair<string, string>> tests = {
+        {"let h = {1: \"a\", true: \"b\"}; [h[1], h[true], h]", "[a, b, {1: a, true: b}]"},
+        {"let h = {\"ab\": 1, \"a\" + \"b\": 2, \"ba\": 3}; [h[\"ab\"], h[\"ba\"], h[\"b\"], h[1]]", "[2, 3, null, null]"},
+        {"let h = {3: 1, 1: 2, 3: 4}; [h[3], h[2], h[\"3\"], h]", "[4, null, null, {3: 4, 1: 2}]"},
+        {"let h = {1: 1, \"1\": 2, false: 3}; [h[1], h[\"1\"], h[false], h[0]]", "[1, 2, 3, null]"},
+    };
+    for (auto& test : tests) {
+        auto program = Program();
+        parse(test.first, &program);
+        auto compiler = Compiler();
+        if (compiler.compileProgram(&program)) FAIL() << "test failed due to error in compiler..." << endl;
+        auto vm = VM(compiler.getByteCode());
+        if (vm.run()) FAIL() << "test failed due to error in vm..." << endl;
+        ASSERT_EQ(vm.getLastPopped().serialize(), test.second) << test.first;
+    }
+
+    // growing keeps every entry reachable and in insertion order
+    FlatTable<IntEntry> table;
+    for (int i = 0; i < 10000; i++) table.insert(integerValue(i * 7919), integerValue(i));
+    ASSERT_EQ(table.entries.size(), 10000);
+    ASSERT_EQ(table.control.size() % hashGroupWidth, 0);
+    for (int i = 0; i < 10000; i++) {
+        const IntEntry* entry = table.find(integerValue(i * 7919));
+        ASSERT_NE(entry, nullptr);
+        ASSERT_EQ(entry->value.integer, i);
+        ASSERT_EQ(table.entries.at(i).key, i * 7919);
+    }
+    ASSERT_EQ(table.find(integerValue(1)), nullptr);
+    ASSERT_EQ(table.find(booleanValue(true)), nullptr);
+    ASSERT_EQ(FlatTable<StringEntry>().find(integerValue(1)), nullptr);
+}
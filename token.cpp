@@ -45,12 +45,15 @@ struct TokenType {
     const string IF = "IF";
     const string ELSE = "ELSE";
     const string RETURN = "RETURN";
+    const string WHILE = "WHILE";
 
 } types;
 
 struct Token {
     string type;
     string literal;
+    int line = 0; // position of the first character, 1-based; 0 for tokens made up by the parser
+    int column = 0;
 };
 
 Token NewToken(string type, char c) {
@@ -67,7 +70,8 @@ map<string, string> literalToType = {
     {"false", types.FALSE},
     {"if", types.IF},
     {"else", types.ELSE},
-    {"return", types.RETURN}
+    {"return", types.RETURN},
+    {"while", types.WHILE}
 };
 string getType(string literal) {
     if (literalToType.count(literal)) {
@@ -0,0 +1,46 @@
+#include"image.cpp"
+#include<vector>
+
+using namespace std;
+
+const int stackSize = 2048;
+const int frameStackSize = 1024;
+const int globalsSize = 4096;
+
+/******************** bytecode verifier *******************/
+/* Prove that code is well formed, so the VM can run it without bounds checks:
+constant and global operands are in range, and stackDepth accepts the control flow
+and stack use. The depth recorded by the compiler, if any, must be the one found
+here, as the VM sizes frames by it. numGlobals is raised to cover every global used. */
+int verifyCode(const byte* code, int size, bool function, int numConstants, int recordedDepth, int* maxDepth, int* numGlobals) {
+    for (auto& ins : InstructionRange(code, size)) {
+        if (!ins.valid) return 1; // unknown opcode or truncated operand
+        if (ins.opcode == OpConstant && ins.operands[0] >= numConstants) return 1; // no such constant
+        if (ins.opcode == OpHash && ins.operands[0] % 2 != 0) return 1; // key without a value
+        if (ins.opcode == OpGetGlobal || ins.opcode == OpSetGlobal) {
+            if (ins.operands[0] >= globalsSize) return 1; // no such global
+            *numGlobals = max(*numGlobals, ins.operands[0] + 1);
+        }
+    }
+    if (stackDepth(code, size, function, maxDepth)) return 1;
+    if (*maxDepth > stackSize) return 1; // frame larger than the whole stack
+    if (recordedDepth >= 0 && recordedDepth != *maxDepth) return 1; // wrong frame size metadata
+    return 0;
+}
+
+/* Verify bytecode whose constants follow firstConstant verified ones. Functions
+loaded without a recorded depth get the verified one. */
+int verifyProgram(ByteCode& bytecode, int firstConstant, int* numGlobals) {
+    int depth = 0;
+    int numConstants = firstConstant + bytecode.constants.size();
+    for (auto& constant : bytecode.constants) {
+        if (constant->kind != CompiledFunctionObject) continue;
+        CompiledFunction* fn = static_cast<CompiledFunction*>(constant.get());
+        if (verifyCode(fn->instructions.data(), fn->instructions.size(), true, numConstants, fn->maxStack, &depth, numGlobals)) return 1;
+        fn->maxStack = depth;
+    }
+    const Instruction& main = bytecode.instructions;
+    if (verifyCode(main.data(), main.size(), false, numConstants, bytecode.maxStack, &depth, numGlobals)) return 1;
+    bytecode.maxStack = depth;
+    return 0;
+}
@@ -1,53 +1,124 @@
-#include"compiler.cpp"
+#include"heap.cpp"
 #include<iostream>
 
 using namespace std;
 
-const int stackSize = 2048;
-const int frameStackSize = 1024;
-const int globalsSize = 4096;
+/* Threaded dispatch: every handler jumps straight to the next one through a table
+of label addresses, a GCC and Clang extension. Build with -DSWITCH_DISPATCH
+(cmake -DSWITCH_DISPATCH=ON) to leave it out; the switch loop is always built. */
+#if defined(__GNUC__) && !defined(SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+/* Build with -DCOUNT_INSTRUCTIONS (cmake -DCOUNT_INSTRUCTIONS=ON) to count executed
+instructions in executedInstructions; dispatch stays free of the count otherwise. */
+#ifdef COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION() executedInstructions++
+#else
+#define COUNT_INSTRUCTION()
+#endif
+
+#ifdef THREADED_DISPATCH
+#define TARGET(op) case op: label_##op:
+#define NEXT() \
+    if (threaded && ip < end) { \
+        opcode = OpCode(*ip++); \
+        COUNT_INSTRUCTION(); \
+        goto *labels[(int) opcode]; \
+    } \
+    break
+#else
+#define TARGET(op) case op:
+#define NEXT() break
+#endif
 
 class VM {
     public:
-    vector<unique_ptr<Object>> constants;
-    vector<unique_ptr<Object>> globals;
+    Heap heap;
+    deque<Value> constants; // a deque, predecoded code points at its elements
+    vector<Value> globals;
     vector<unique_ptr<Frame>> frames;
     int frameIndex; // points to the next free slot in frame stack
     // Instruction instructions;
 
-    vector<unique_ptr<Object>> stack;
+    vector<Value> stack;
     int sp; // always points to the next free slot in stack
+    long long executedInstructions = 0; // stays 0 unless built with COUNT_INSTRUCTIONS
+    bool verified; // the loaded program passed the verifier, and so did every function it can reach
+    bool unverifiedFunctions = false; // a program that failed the verifier ran, and globals may hold its functions
+    bool predecoded; // the loaded program and its functions could be translated to slots
+    bool threadedDispatch = true; // ignored unless built with THREADED_DISPATCH
+    SlotCode mainCode;
 
+    /* Stack and globals start at what the verified program needs and the stack
+    grows on calls; unverified code gets the full limits up front. */
     VM(ByteCode bytecode) {
         // instructions = bytecode.instructions;
-        constants = move(bytecode.constants);
-        globals = vector<unique_ptr<Object>>(globalsSize);
-        stack = vector<unique_ptr<Object>>(stackSize);
         sp = 0;
+        reserve(bytecode, 0);
 
-        frames = vector<unique_ptr<Frame>>(frameStackSize);
+        frames.push_back(make_unique<Frame>(&mainCode));
         frameIndex = 1;
-        auto mainFn = CompiledFunction(bytecode.instructions);
-        frames.at(0) = make_unique<Frame>(mainFn);
     };
 
-    Frame* getCurrFrame() {
-        return frames.at(frameIndex - 1).get();
+    /* Run another program against the same globals, e.g. the next line of a REPL
+    session. Its constants continue the indices of the ones already loaded. */
+    void load(ByteCode bytecode) {
+        reserve(bytecode, constants.size());
+        sp = 0;
+        stack.at(0) = Value(); // no value popped yet
+        frameIndex = 1;
+        frames.at(0)->ip = 0;
     }
 
-    int getCurrIp() {
-        return frames.at(frameIndex - 1).get()->ip;
+    /* Verify and predecode newly loaded code, take over its constants and grow the
+    stack and globals to fit it */
+    void reserve(ByteCode& bytecode, int firstConstant) {
+        int numGlobals = globals.size();
+        bool passed = verifyProgram(bytecode, firstConstant, &numGlobals) == 0;
+        bool functions = false;
+        for (auto& constant : bytecode.constants) {
+            functions = functions || constant->kind == CompiledFunctionObject;
+            constants.push_back(heap.constant(move(constant)));
+        }
+        predecoded = true; // per program: one that does not decode never runs, so cannot leave its functions behind
+        for (int i = firstConstant; i < constants.size(); i++) {
+            if (constants.at(i).kind != ObjectValue || constants.at(i).object->kind != CompiledFunctionObject) continue;
+            CompiledFunction* fn = static_cast<CompiledFunction*>(constants.at(i).object);
+            auto code = make_shared<SlotCode>();
+            predecoded = predecoded && predecode(fn->instructions, constants, code.get()) == 0;
+            fn->slots = code;
+        }
+        predecoded = predecoded && predecode(bytecode.instructions, constants, &mainCode) == 0;
+        // per program too, unless unverified functions may be called from it
+        verified = passed && !unverifiedFunctions;
+        if (!passed && functions && predecoded) unverifiedFunctions = true;
+        int stackSlots = verified ? bytecode.maxStack + 1 : stackSize; // one more for the last popped value
+        if (!verified) numGlobals = globalsSize;
+        if (stack.size() < stackSlots) stack.resize(stackSlots);
+        if (globals.size() < numGlobals) globals.resize(numGlobals);
     }
-    void setCurrIp(int ip) {
-        frames.at(frameIndex - 1).get()->ip = ip;
+
+    /* Make room for a call frame of the given depth on top of the stack */
+    int growStack(int depth) {
+        int needed = sp + depth;
+        if (needed > stackSize) return 1; // stack overflow
+        if (needed > stack.size()) stack.resize(min(stackSize, max(needed, 2 * (int) stack.size())));
+        return 0;
     }
 
-    int getCurrFrameSize() {
-        return frames.at(frameIndex - 1).get()->getInstructions().size();
+    Frame* getCurrFrame() {
+        return frames.at(frameIndex - 1).get();
     }
 
-    void pushFrame(unique_ptr<Frame> frame) {
-        frames.at(frameIndex) = move(frame);
+    /* Frames are allocated once per call depth and reused by every later call to that depth */
+    void pushFrame(const SlotCode* code) {
+        if (frameIndex == frames.size()) {
+            frames.push_back(make_unique<Frame>(code));
+        } else {
+            frames[frameIndex]->code = code;
+            frames[frameIndex]->ip = 0;
+        }
         frameIndex++;
     }
 
@@ -56,31 +127,35 @@ class VM {
         return frames.at(frameIndex).get();
     }
 
-    unique_ptr<Object>& getLastPopped() {
+    Value& getLastPopped() {
         return stack.at(sp);
     }
 
-    int push(unique_ptr<Object> constant) {
-        if (sp >= stackSize) return 1; // stack overflow
-        stack.at(sp++) = move(constant);
+    /* Bounds-checked element access, unless the verifier proved the index in range */
+    template<bool checked, typename T> T& slot(vector<T>& v, int idx) {
+        if constexpr (checked) return v.at(idx);
+        else return v[idx];
+    }
+
+    template<bool checked = true> int push(Value value) {
+        if (checked && sp >= stackSize) return 1; // stack overflow
+        slot<checked>(stack, sp++) = move(value);
         return 0;
     }
 
-    unique_ptr<Object>& pop() {
-        return stack.at(--sp);
+    template<bool checked = true> Value& pop() {
+        return slot<checked>(stack, --sp);
     }
+
     
-    int isTrue(unique_ptr<Object>& obj) {
-        string type = obj.get()->getType();
-        if (type == objs.BOOLEAN_OBJ) {
-            Boolean* boolean = dynamic_cast<Boolean*>(obj.get());
-            return boolean->value;
-        } else if (type == objs.NULL_OBJ) {
+    int isTrue(Value& value) {
+        if (value.kind == BooleanValue) {
+            return value.boolean;
+        } else if (value.kind == NullValue) {
             return false;
-        } else if (type == objs.INTEGER_OBJ) {
-            Integer* integer = dynamic_cast<Integer*>(obj.get());
-            return integer->value;
-        } 
+        } else if (value.kind == IntegerValue) {
+            return value.integer;
+        }
         // else if (type == objs.STRING_OBJ) {
         //     String* str = dynamic_cast<String*>(obj.get());
         //     return str->value
@@ -91,60 +166,106 @@ class VM {
     }
 
     int run() {
-        while (getCurrIp() < getCurrFrameSize()) { // ip at the end of the loop points the the last executed instruction
-            Frame* frame = getCurrFrame();
-            int ip = frame->ip;
-            auto instructions = frame->getInstructions();
-            auto opcode = OpCode(instructions.at(ip));
+        if (!predecoded) return 1; // code does not decode
+#ifdef THREADED_DISPATCH
+        if (threadedDispatch) return verified ? execute<false, true>() : execute<true, true>();
+#endif
+        return verified ? execute<false, false>() : execute<true, false>();
+    }
+
+    /* The dispatch loop over predecoded code, which is well formed by construction.
+    Unless checked, every index into the globals and stack is trusted too; only the
+    depth of calls is checked, once per call. If threaded, only the first
+    instruction goes through the switch. */
+    template<bool checked, bool threaded> int execute() {
+#ifdef THREADED_DISPATCH
+#define OPCODE_LABEL(name, ...) &&label_##name,
+        static void* const labels[] = {OPCODES(OPCODE_LABEL)};
+#undef OPCODE_LABEL
+#endif
+        // the current frame lives in locals, it is only written back on calls
+        const uint32_t* code;
+        const uint32_t* end;
+        const uint32_t* ip;
+        auto enterFrame = [&]() {
+            Frame* frame = slot<checked>(frames, frameIndex - 1).get();
+            code = frame->code->data();
+            end = code + frame->code->size();
+            ip = code + frame->ip;
+        };
+        enterFrame();
+        while (ip < end) {
+            auto opcode = OpCode(*ip++); // ip now points to the operands
+
+            COUNT_INSTRUCTION();
             switch (opcode) {
-                case OpConstant: 
+                TARGET(OpConstant)
                     {   
-                        int constIndex = 0;
-                        for (int i = 0; i < 4; i++) {
-                            constIndex = (constIndex << 8) | (int) instructions.at(++ip);
-                        }
-                        if (push(move(constants.at(constIndex)))) return 1;
+                        Value* constant = readPointer(ip);
+                        ip += pointerSlots;
+                        if (push<checked>(*constant)) return 1; // constants are shared by every execution of the instruction
                     }
-                    break;
-                case OpAdd: case OpMul: case OpDiv: case OpSub:
+                    NEXT();
+                TARGET(OpAdd) TARGET(OpMul) TARGET(OpDiv) TARGET(OpSub)
                 {
-                    unique_ptr<Object>& right = pop();
-                    unique_ptr<Object>& left = pop();
-
-                    // string concat
-                    if (opcode == OpAdd && left.get()->getType() == objs.STRING_OBJ && right.get()->getType() == objs.STRING_OBJ) {
-                        String* leftStr = dynamic_cast<String*>(left.get());
-                        String* rightStr = dynamic_cast<String*>(right.get());
-                        unique_ptr<Object> o = make_unique<String>(leftStr->value + rightStr->value);
-                        if (push(move(o))) return 1; // failed to push str to stack
-                        break;
-                    }
+                    Value& right = pop<checked>();
+                    Value& left = pop<checked>();
 
                     // integer arithemtic
-                    if (left.get()->getType() != objs.INTEGER_OBJ || right.get()->getType() != objs.INTEGER_OBJ) {
-                        return 1; // wrong type
+                    if (left.kind == IntegerValue && right.kind == IntegerValue) {
+                        int res = 0;
+                        switch (opcode) {
+                            case OpAdd: res = left.integer + right.integer; break;
+                            case OpSub: res = left.integer - right.integer; break;
+                            case OpMul: res = left.integer * right.integer; break;
+                            case OpDiv: res = left.integer / right.integer; break;
+                            default:
+                                return 1; // unrecognized operation
+                        }
+                        if (push<checked>(integerValue(res))) return 1;
+                        NEXT();
                     }
-                    Integer* leftInt = dynamic_cast<Integer*>(left.get());
-                    Integer* rightInt = dynamic_cast<Integer*>(right.get());
+
+                    // string concat
+                    if (opcode != OpAdd || left.kind != ObjectValue || right.kind != ObjectValue) return 1; // wrong type
+                    if (left.object->kind != StringObject || right.object->kind != StringObject) return 1; // wrong type
+                    String* leftStr = static_cast<String*>(left.object);
+                    String* rightStr = static_cast<String*>(right.object);
+                    if (push<checked>(heap.allocate<String>(leftStr->value + rightStr->value))) return 1; // failed to push str to stack
+                    if (heap.collectionDue()) collectGarbage();
+                }    
+                NEXT();
+                TARGET(OpAddInt) TARGET(OpSubInt) TARGET(OpMulInt) TARGET(OpDivInt)
+                {
+                    // the compiler proved both operands are integers
+                    int right = pop<checked>().integer;
+                    int left = pop<checked>().integer;
                     int res = 0;
                     switch (opcode) {
-                        case OpAdd: res = leftInt->value + rightInt->value; break;
-                        case OpSub: res = leftInt->value - rightInt->value; break;
-                        case OpMul: res = leftInt->value * rightInt->value; break;
-                        case OpDiv: res = leftInt->value / rightInt->value; break;
+                        case OpAddInt: res = left + right; break;
+                        case OpSubInt: res = left - right; break;
+                        case OpMulInt: res = left * right; break;
+                        case OpDivInt: res = left / right; break;
                         default:
                             return 1; // unrecognized operation
                     }
-                    unique_ptr<Object> o = make_unique<Integer>(res);
-                    if (push(move(o))) return 1;
-                }    
-                break;
-                case OpTrue: if (push(make_unique<Boolean>(true))) return 1; break;
-                case OpFalse: if (push(make_unique<Boolean>(false))) return 1; break;
-                case OpEq: case OpNeq: case OpGt:
+                    if (push<checked>(integerValue(res))) return 1;
+                }
+                NEXT();
+                TARGET(OpTrue) if (push<checked>(booleanValue(true))) return 1; NEXT();
+                TARGET(OpFalse) if (push<checked>(booleanValue(false))) return 1; NEXT();
+                TARGET(OpEq) TARGET(OpNeq) TARGET(OpGt)
                     {   
-                        int right = isTrue(pop());
-                        int left = isTrue(pop());
+                        Value& rightValue = pop<checked>();
+                        Value& leftValue = pop<checked>();
+                        // scalars of one kind are equal exactly when their payloads are
+                        if (opcode != OpGt && leftValue.kind == rightValue.kind && leftValue.kind != ObjectValue) {
+                            bool same = leftValue.bits == rightValue.bits;
+                            if (push<checked>(booleanValue(opcode == OpEq ? same : !same))) return 1;
+                            NEXT();
+                        }
+                        int right = isTrue(rightValue);
+                        int left = isTrue(leftValue);
                         if (right == -1 || left == -1) return 1; // cannot assign boolean value to obj
                         bool res = false;
                         switch (opcode) {
@@ -154,202 +275,187 @@ class VM {
                             default:
                                 return 1; // unrecognized operation
                         }
-                        unique_ptr<Object> o = make_unique<Boolean>(res);
-                        if (push(move(o))) return 1;
+                        if (push<checked>(booleanValue(res))) return 1;
 
                     }
-                    break;
-                case OpMinus:
+                    NEXT();
+                TARGET(OpMinus)
                     {
-                        unique_ptr<Object>& operand = pop();
-                        if (operand.get()->getType() != objs.INTEGER_OBJ) return 1; // invalid operand for prefix operator '-'
-                        Integer* integer = dynamic_cast<Integer*>(operand.get());
-                        push(make_unique<Integer>(-integer->value));
+                        Value& operand = pop<checked>();
+                        if (operand.kind != IntegerValue) return 1; // invalid operand for prefix operator '-'
+                        push<checked>(integerValue(-operand.integer));
                     }
-                    break;
-                case OpSurprise:
+                    NEXT();
+                TARGET(OpSurprise)
                     {
-                        int boolean = isTrue(pop());
+                        int boolean = isTrue(pop<checked>());
                         if (boolean == -1) return 1; // cannot assign boolean value to operand
-                        push(make_unique<Boolean>(!boolean));
+                        push<checked>(booleanValue(!boolean));
                     }
-                    break;
-                case OpPop:
-                    pop();
-                    break;
-                case OpNull:
-                    if (push(make_unique<Null>())) return 1; // failed to push null to stack
-                    break;
-                case OpJump:
-                {
-                    int jumpAddr = 0;
-                    for (int i = 0; i < 4; i++) {
-                        jumpAddr = (jumpAddr << 8) | (int) instructions.at(++ip);
-                    }
-                    ip = jumpAddr - 1;
-                }
-                break;
-                case OpJumpIfFalse:
+                    NEXT();
+                TARGET(OpPop)
+                    pop<checked>();
+                    NEXT();
+                TARGET(OpNull)
+                    if (push<checked>(nullValue())) return 1; // failed to push null to stack
+                    NEXT();
+                TARGET(OpJump)
+                    ip = code + *ip;
+                    NEXT();
+                TARGET(OpLoop)
+                    // back edge of a loop: the hook point for interrupt checks and hot-loop counters
+                    ip = code + *ip;
+                    NEXT();
+                TARGET(OpJumpIfFalse)
                 {
-                    int jumpAddr = 0;
-                    for (int i = 0; i < 4; i++) {
-                        jumpAddr = (jumpAddr << 8) | (int) instructions.at(++ip);
-                    }
-
-                    int condition = isTrue(pop());
+                    int target = *ip++;
+                    int condition = isTrue(pop<checked>());
                     if (!condition) {
-                        ip = jumpAddr - 1;
+                        ip = code + target;
                     }
                 }
-                break;
-                case OpGetGlobal:
+                NEXT();
+                TARGET(OpGetGlobal)
                 {   
-                    int index = 0;
-                    for (int i = 0; i < 4; i++) {
-                        index = (index << 8) | (int) instructions.at(++ip);
-                    }
-                    unique_ptr<Object> up = copyPtr(globals.at(index));
-                    push(move(up));
+                    int index = *ip++;
+                    if (slot<checked>(globals, index).empty()) return 1; // defined by a line that failed to run
+                    push<checked>(slot<checked>(globals, index));
                 }
-                break;
-                case OpSetGlobal:
+                NEXT();
+                TARGET(OpSetGlobal)
                 {   
-                    int index = 0;
-                    for (int i = 0; i < 4; i++) {
-                        index = (index << 8) | (int) instructions.at(++ip);
-                    }
-                    globals.at(index) = move(pop());
+                    int index = *ip++;
+                    Value& value = pop<checked>();
+                    Value& global = slot<checked>(globals, index);
+                    heap.overwrite(global);
+                    global = value;
+                    value = Value(); // a let statement has no value to print
                 }
-                break;
-                case OpArray:
+                NEXT();
+                TARGET(OpArray)
                 {
-                    int numElements = 0;
-                    for (int i = 0; i < 4; i++) {
-                        numElements = (numElements << 8) | (int) instructions.at(++ip);
-                    }
+                    int numElements = *ip++;
 
                     // build array
-                    auto elements = vector<unique_ptr<Object>>(numElements);
+                    auto elements = vector<Value>(numElements);
                     for (int p = 0; p < numElements; p++) {
-                        elements.at(p) = move(stack.at(sp-numElements + p));
+                        elements.at(p) = move(slot<checked>(stack, sp-numElements + p));
                     }
-                    push(make_unique<Array>(move(elements)));
+                    sp -= numElements;
+                    push<checked>(heap.allocate<Array>(move(elements)));
+                    if (heap.collectionDue()) collectGarbage();
                 }
-                break;
-                case OpHash:
+                NEXT();
+                TARGET(OpHash)
                 {
-                    int numElements = 0;
-                    for (int i = 0; i < 4; i++) {
-                        numElements = (numElements << 8) | (int) instructions.at(++ip);
-                    }
+                    int numElements = *ip++;
 
-                    // make hashtable
-                    map<HashKey, unique_ptr<HashPair>> table = {};
+                    // make hashtable, with the entry layout all its keys fit
+                    bool ints = true, strings = true;
                     for (int p = sp - numElements; p < sp; p+=2) {
-                        if (!stack.at(p).get()->hashable()) {
+                        Value& key = slot<checked>(stack, p);
+                        if (!key.hashable()) {
                             return 1; // cannot hash
                         }
-                        auto key = hashKey(stack.at(p));
-                        table[key] = make_unique<HashPair>(stack.at(p), stack.at(p + 1));
+                        ints = ints && IntEntry::accepts(key);
+                        strings = strings && StringEntry::accepts(key);
                     }
-                    push(make_unique<HashTable>(move(table)));
+                    const Value* pairs = stack.data() + sp - numElements;
+                    Value table;
+                    if (ints) table = heap.allocate<FlatHashTable<IntEntry>>(buildTable<IntEntry>(pairs, numElements));
+                    else if (strings) table = heap.allocate<FlatHashTable<StringEntry>>(buildTable<StringEntry>(pairs, numElements));
+                    else table = heap.allocate<FlatHashTable<ValueEntry>>(buildTable<ValueEntry>(pairs, numElements));
+                    sp -= numElements;
+                    push<checked>(table);
+                    if (heap.collectionDue()) collectGarbage();
                 }
-                break;
-                case OpIndex:
+                NEXT();
+                TARGET(OpIndex)
                 {
-                    unique_ptr<Object>& index = pop();
-                    unique_ptr<Object>& entity = pop();
-                    string type = entity.get()->getType();
-                    if (type == objs.ARRAY_OBJ) {
-                        if (index.get()->getType() != objs.INTEGER_OBJ) {
+                    Value& index = pop<checked>();
+                    Value& entity = pop<checked>();
+                    ObjectKind kind = entity.kind == ObjectValue ? entity.object->kind : IntegerObject; // scalars cannot be indexed
+                    if (kind == ArrayObject) {
+                        if (index.kind != IntegerValue) {
                             return 1; // invalid index
                         }
-                        Integer* integer = dynamic_cast<Integer*>(index.get());
-                        Array* arr = dynamic_cast<Array*>(entity.get());
-                        int idx = integer->value;
+                        Array* arr = static_cast<Array*>(entity.object);
+                        int idx = index.integer;
                         if (idx < 0 || idx >= arr->elements.size()) {
-                            push(make_unique<Null>());
+                            push<checked>(nullValue());
                         } else {
-                            push(move(copyPtr(arr->elements.at(idx))));
+                            push<checked>(arr->elements.at(idx));
                         }
-                    } else if (type == objs.HASH_TABLE) {
-                        if (!index.get()->hashable()) {
+                    } else if (kind == HashTableObject) {
+                        if (!index.hashable()) {
                             return 1; // key is not hashable
                         };
                         
-                        auto key = hashKey(index);
-                        HashTable* table = dynamic_cast<HashTable*>(entity.get());
-                        if (table->table.count(key) == 0) {
-                            push(make_unique<Null>());
-                        } else {
-                            push(move(table->table[key].get()->value));
-                        }
+                        const Value* value = static_cast<HashTable*>(entity.object)->get(index);
+                        push<checked>(value == nullptr ? nullValue() : *value);
+                    } else {
+                        return 1; // cannot index this type
                     }
                 }
-                break;
-                case OpCall:
+                NEXT();
+                TARGET(OpCall)
                 {   
-                    CompiledFunction* fn = dynamic_cast<CompiledFunction*>(stack.at(sp - 1).get());
-                    if (fn == nullptr) {
+                    Value& callee = slot<checked>(stack, sp - 1);
+                    if (callee.kind != ObjectValue || callee.object->kind != CompiledFunctionObject) {
                         return 1; // failed to get function from stack
                     }
-                    pushFrame(make_unique<Frame>(*fn));
+                    CompiledFunction* fn = static_cast<CompiledFunction*>(callee.object);
+                    if (frameIndex >= frameStackSize) return 1; // too many nested calls
+                    if (!checked && growStack(fn->maxStack)) return 1; // the only stack check verified code needs
+                    frames[frameIndex - 1]->ip = ip - code; // return address
+                    pushFrame(fn->slots.get());
+                    enterFrame();
                 }
-                break;
-                case OpRetVal:
+                NEXT();
+                TARGET(OpRetVal)
                 {   
-                    auto ret = move(pop()); // pop return result
+                    auto ret = move(pop<checked>()); // pop return result
                     popFrame(); // pop function frame
-                    pop(); // pop function
-                    push(move(ret));
+                    pop<checked>(); // pop function
+                    push<checked>(move(ret));
+                    enterFrame();
                 }
-                break;
-                case OpRet:
+                NEXT();
+                TARGET(OpRet)
                 {
                     popFrame();
-                    pop();
-                    push(make_unique<Null>());
+                    pop<checked>();
+                    push<checked>(nullValue());
+                    enterFrame();
                 }
-                break;
+                NEXT();
+                TARGET(OpWide) // never in predecoded code
                 default:
-                    break;
+                    NEXT();
             }
-            // setCurrIp(ip + 1);
-            frame->ip = ip + 1;
         }
+        frames[frameIndex - 1]->ip = ip - code;
         return 0;
     }
 
-    template<typename T> unique_ptr<Object> copyPtr(unique_ptr<T>& up) {
-        string type = up.get()->getType();
-        if (type == objs.BOOLEAN_OBJ) {
-            Boolean* boolean = dynamic_cast<Boolean*>(up.get());
-            return make_unique<Boolean>(*boolean);
-        } else if (type == objs.INTEGER_OBJ) {
-            Integer* integer = dynamic_cast<Integer*>(up.get());
-            return make_unique<Integer>(*integer);
-        } else if (type == objs.STRING_OBJ) {
-            String* str = dynamic_cast<String*>(up.get());
-            return make_unique<String>(*str);
-        } else if (type == objs.ARRAY_OBJ) {
-            Array* arr = dynamic_cast<Array*>(up.get());
-            return make_unique<Array>(move(arr->elements));
-        } else if (type == objs.COMPILED_FUNCTION_OBJ) {
-            CompiledFunction* fn = dynamic_cast<CompiledFunction*>(up.get());
-            return make_unique<CompiledFunction>(*fn);
-        } else if (type == objs.HASH_TABLE) {
-            HashTable* hash = dynamic_cast<HashTable*>(up.get());
-            return make_unique<HashTable>(move(hash->table));
-        } else {
-            return make_unique<Null>();
-        }
+    /* Frames need no marking, their code belongs to function constants. The slot
+    at sp is kept for getLastPopped. */
+    HeapRoots roots() {
+        return HeapRoots{&stack, sp, &globals, &constants};
+    }
+
+    /* Only called where every live value is on the stack, in globals or a constant:
+    right after an allocating instruction pushed its result */
+    void collectGarbage() {
+        if (heap.incremental) heap.step(roots());
+        else heap.collect(roots());
     }
 
-    unique_ptr<Object> buildArray(int start, int end) {
-        auto elements = vector<unique_ptr<Object>>(end - start);
+    Value buildArray(int start, int end) {
+        auto elements = vector<Value>(end - start);
         for (int p = start; p < end; p++) {
             elements.at(p-start) = move(stack.at(p));
         }
-        return make_unique<Array>(move(elements));
+        return heap.allocate<Array>(move(elements));
     }
 };
\ No newline at end of file